@@ -40,11 +40,56 @@ static int tt;
 module_param(tt, int, 0444);
 MODULE_PARM_DESC(tt, "");
 
+static int irq_mod_high;
+module_param(irq_mod_high, int, 0444);
+MODULE_PARM_DESC(irq_mod_high,
+		 "IRQs/s of an input above which it is polled, 0-off (default)");
+
+static int irq_mod_interval = 2;
+module_param(irq_mod_interval, int, 0444);
+MODULE_PARM_DESC(irq_mod_interval, "Poll interval in ms (default 2)");
+
+static int irq_mod_idle = 4;
+module_param(irq_mod_idle, int, 0444);
+MODULE_PARM_DESC(irq_mod_idle,
+		 "Idle polls before input IRQ is enabled again (default 4)");
+
+static int irq_mod_budget = 4;
+module_param(irq_mod_budget, int, 0444);
+MODULE_PARM_DESC(irq_mod_budget, "Inputs served per poll (default 4)");
+
+static int probe_async = 1;
+module_param(probe_async, int, 0444);
+MODULE_PARM_DESC(probe_async,
+		 "Probe the ports of a card in parallel, 0-one after the other");
+
+static int dma_lazy;
+module_param(dma_lazy, int, 0444);
+MODULE_PARM_DESC(dma_lazy,
+		 "Allocate DMA buffers on first use instead of at probe");
+
+#ifdef DDB_ALT_DMA
+static int dma_mode = 1;
+#else
+static int dma_mode;
+#endif
+module_param(dma_mode, int, 0444);
+MODULE_PARM_DESC(dma_mode,
+		 "DMA buffers: 0-coherent, 1-streaming kmalloc, 2-streaming pages");
+
+static int dma_idle;
+module_param(dma_idle, int, 0644);
+MODULE_PARM_DESC(dma_idle,
+		 "Seconds after which unused lazy DMA buffers are freed, 0-never");
+
 #define DDB_MAX_ADAPTER 32
 static struct ddb *ddbs[DDB_MAX_ADAPTER];
 
 DVB_DEFINE_MOD_OPT_ADAPTER_NR(adapter_nr);
 
+#define CREATE_TRACE_POINTS
+#include "ddbridge-trace.h"
+
 #include "ddbridge-mod.c"
 #include "ddbridge-i2c.c"
 #include "ddbridge-ns.c"
@@ -99,6 +144,89 @@ static void ddb_redirect_dma(struct ddb *dev,
 	}
 }
 
+/* Redirect chains:
+   redirect_lock only serializes changes of the redirect setup. After each
+   change the chain descriptors of all inputs are rebuilt and published,
+   so starting and stopping a chain only needs rcu_read_lock(). */
+
+static struct ddb_chain *ddb_chain_build(struct ddb_input *input)
+{
+	struct ddb_chain *c;
+	struct ddb_input *i = input;
+	struct ddb_output *o;
+	u32 j;
+
+	if (!input->redo)
+		return 0;
+	c = kzalloc(sizeof(*c), GFP_KERNEL);
+	if (!c)
+		return 0;
+	while (i && (o = i->redo) && c->num < DDB_CHAIN_MAX) {
+		c->out[c->num] = 1;
+		c->io[c->num++] = o;
+		for (j = 0; j < i->fan_num && c->num < DDB_CHAIN_MAX; j++) {
+			c->out[c->num] = 1;
+			c->io[c->num++] = i->fan[j];
+		}
+		i = o->port->input[0];
+		if (i && c->num < DDB_CHAIN_MAX)
+			c->io[c->num++] = i;
+	}
+	return c;
+}
+
+static void ddb_chain_set(struct ddb_input *input, struct ddb_chain *c)
+{
+	struct ddb_chain *old;
+
+	old = rcu_dereference_protected(input->chain,
+					lockdep_is_held(&redirect_lock));
+	rcu_assign_pointer(input->chain, c);
+	if (old)
+		kfree_rcu(old, rcu);
+}
+
+static void ddb_chains_update(void)
+{
+	struct ddb *dev;
+	struct ddb_input *input;
+	int d, i;
+
+	for (d = 0; d < DDB_MAX_ADAPTER; d++) {
+		dev = ddbs[d];
+		if (!dev || !dev->has_dma)
+			continue;
+		for (i = 0; i < DDB_MAX_INPUT; i++) {
+			input = &dev->input[i];
+			if (input->port)
+				ddb_chain_set(input, ddb_chain_build(input));
+		}
+	}
+}
+
+/* Fan-out: the outputs in input->fan read the same buffers as input->redo,
+   the input writes into. They are leaves, a CI return path of them is not
+   part of the redirect chain. */
+
+static void ddb_unfan(struct ddb_input *input, struct ddb_output *output)
+{
+	u32 i;
+
+	for (i = 0; i < input->fan_num; i++)
+		if (input->fan[i] == output)
+			break;
+	if (i == input->fan_num)
+		return;
+	input->fan[i] = input->fan[--input->fan_num];
+	input->fan[input->fan_num] = 0;
+	output->redi = 0;
+	ddb_set_dma_table(output->port->dev, output->dma);
+}
+
+static int ddb_dma_get(struct ddb *dev, struct ddb_dma *dma);
+static void ddb_dma_put(struct ddb_dma *dma);
+static void ddb_dma_idle(struct ddb_dma *dma);
+
 static int ddb_unredirect(struct ddb_port *port)
 {
 	struct ddb_input *oredi, *iredi = 0;
@@ -113,6 +241,13 @@ static int ddb_unredirect(struct ddb_port *port)
 	oredi = port->output->redi;
 	if (!oredi)
 		goto done;
+	if (oredi->redo != port->output) {
+		ddb_unfan(oredi, port->output);
+		goto done;
+	}
+	/* the fan-out outputs read the buffers of this one */
+	while (oredi->fan_num)
+		ddb_unfan(oredi, oredi->fan[0]);
 	if (port->input[0]) {
 		iredi = port->input[0]->redi;
 		iredo = port->input[0]->redo;
@@ -135,7 +270,12 @@ static int ddb_unredirect(struct ddb_port *port)
 
 	ddb_set_dma_table(oredi->port->dev, oredi->dma);
 done:
+	ddb_chains_update();
 	mutex_unlock(&redirect_lock);
+	/* buffers kept for the redirect may be unused now */
+	ddb_dma_idle(port->output->dma);
+	if (port->input[0])
+		ddb_dma_idle(port->input[0]->dma);
 	return 0;
 }
 
@@ -169,6 +309,22 @@ static int ddb_redirect(u32 i, u32 p)
 		mutex_unlock(&redirect_lock);
 		return -EBUSY;
 	}
+	/* the buffers are kept while the channels are redirected */
+	if (ddb_dma_get(pdev, port->output->dma) < 0) {
+		mutex_unlock(&redirect_lock);
+		return -ENOMEM;
+	}
+	ddb_dma_put(port->output->dma);
+	if (port->input[0]) {
+		if (ddb_dma_get(pdev, port->input[0]->dma) < 0) {
+			mutex_unlock(&redirect_lock);
+			return -ENOMEM;
+		}
+		ddb_dma_put(port->input[0]->dma);
+	}
+	/* fan-out outputs would still read the old buffers */
+	while (input->fan_num)
+		ddb_unfan(input, input->fan[0]);
 	input2 = port->input[0];
 	if (input2) {
 		if (input->redi) {
@@ -181,15 +337,106 @@ static int ddb_redirect(u32 i, u32 p)
 	port->output->redi = input;
 
 	ddb_redirect_dma(input->port->dev, input->dma, port->output->dma);
+	ddb_chains_update();
 	mutex_unlock(&redirect_lock);
 	return 0;
 }
 
+/* Let port p additionally read the stream of input i, which must already
+   be redirected by ddb_redirect(). */
+
+static int ddb_redirect_fan(u32 i, u32 p)
+{
+	struct ddb *idev = ddbs[(i >> 4) & 0x1f];
+	struct ddb *pdev = ddbs[(p >> 4) & 0x1f];
+	struct ddb_input *input;
+	struct ddb_output *output;
+	struct ddb_port *port;
+	int ret = 0;
+
+	if (!idev || !pdev)
+		return -EINVAL;
+	if (!idev->has_dma || !pdev->has_dma)
+		return -EINVAL;
+
+	port = &pdev->port[p & 0x0f];
+	output = port->output;
+	if (!output)
+		return -EINVAL;
+	if (ddb_unredirect(port))
+		return -EBUSY;
+
+	if (i == 8)
+		return 0;
+
+	input = &idev->input[i & 7];
+
+	mutex_lock(&redirect_lock);
+	if (!input->redo || input->redo == output ||
+	    input->fan_num >= DDB_MAX_FAN)
+		ret = -EINVAL;
+	else if (output->dma->running || input->dma->running)
+		ret = -EBUSY;
+	else {
+		output->redi = input;
+		input->fan[input->fan_num++] = output;
+		ddb_redirect_dma(output->port->dev, output->dma,
+				 input->redo->dma);
+		ddb_chains_update();
+	}
+	mutex_unlock(&redirect_lock);
+	return ret;
+}
+
 /****************************************************************************/
 /****************************************************************************/
 /****************************************************************************/
 
-#ifdef DDB_ALT_DMA
+/* CPUs of the card's NUMA node, NULL if there is no placement to do */
+
+static const struct cpumask *ddb_node_cpus(struct ddb *dev)
+{
+	const struct cpumask *mask;
+
+	if (dev->node < 0 || num_online_nodes() < 2)
+		return NULL;
+	mask = cpumask_of_node(dev->node);
+	if (!cpumask_intersects(mask, cpu_online_mask))
+		return NULL;
+	return mask;
+}
+
+/* DMA buffer modes, see dma_mode:
+   0: coherent memory, no cache maintenance needed
+   1: kmalloc()ed streaming buffers, mapped with dma_map_single()
+   2: page backed streaming buffers, mapped with dma_map_page()
+   For the streaming modes the driver syncs exactly the ranges the CPU
+   reads or writes. Outputs are mapped bidirectional because a redirected
+   input also writes into their buffers.
+   All buffers are taken from the card's node, dma_alloc_coherent() does
+   this by itself. */
+
+static enum dma_data_direction ddb_dma_dir(struct ddb_dma *dma)
+{
+	return dma->dir ? DMA_BIDIRECTIONAL : DMA_FROM_DEVICE;
+}
+
+static void ddb_dma_sync_cpu(struct ddb *dev, struct ddb_dma *dma,
+			     u32 buf, u32 off, u32 len)
+{
+	if (dma->mode && len)
+		dma_sync_single_range_for_cpu(dev->dev, dma->pbuf[buf],
+					      off, len, ddb_dma_dir(dma));
+}
+
+static void ddb_dma_sync_dev(struct ddb *dev, struct ddb_dma *dma,
+			     u32 buf, u32 off, u32 len)
+{
+	if (dma->mode && len)
+		dma_sync_single_range_for_device(dev->dev, dma->pbuf[buf],
+						 off, len, ddb_dma_dir(dma));
+}
+
 static void dma_free(struct pci_dev *pdev, struct ddb_dma *dma, int dir)
 {
 	int i;
@@ -197,70 +444,104 @@ static void dma_free(struct pci_dev *pdev, struct ddb_dma *dma, int dir)
 	if (!dma)
 		return;
 	for (i = 0; i < dma->num; i++) {
-		if (dma->vbuf[i]) {
+		if (!dma->vbuf[i])
+			continue;
+		switch (dma->mode) {
+		case 1:
 			dma_unmap_single(&pdev->dev, dma->pbuf[i],
-					 dma->size,
-					 dir ? DMA_TO_DEVICE :
-					 DMA_FROM_DEVICE);
+					 dma->size, ddb_dma_dir(dma));
 			kfree(dma->vbuf[i]);
-			dma->vbuf[i] = 0;
+			break;
+		case 2:
+			dma_unmap_page(&pdev->dev, dma->pbuf[i],
+				       dma->size, ddb_dma_dir(dma));
+			free_pages((unsigned long) dma->vbuf[i],
+				   get_order(dma->size));
+			break;
+		default:
+			pci_free_consistent(pdev, dma->size,
+					    dma->vbuf[i], dma->pbuf[i]);
+			break;
 		}
+		dma->vbuf[i] = 0;
 	}
 }
 
 static int dma_alloc(struct pci_dev *pdev, struct ddb_dma *dma, int dir)
 {
-	int i;
+	int i, node = dev_to_node(&pdev->dev);
+	struct page *page;
 
 	if (!dma)
 		return 0;
 	for (i = 0; i < dma->num; i++) {
-		dma->vbuf[i] = kmalloc(dma->size, __GFP_REPEAT);
-		if (!dma->vbuf[i])
-			return -ENOMEM;
-		dma->pbuf[i] = dma_map_single(&pdev->dev, dma->vbuf[i],
-					      dma->size,
-					      dir ? DMA_TO_DEVICE :
-					      DMA_FROM_DEVICE);
-		if (dma_mapping_error(&pdev->dev, dma->pbuf[i])) {
-			kfree(dma->vbuf[i]);
-			return -ENOMEM;
+		switch (dma->mode) {
+		case 1:
+			dma->vbuf[i] = kmalloc_node(dma->size,
+						    GFP_KERNEL | __GFP_REPEAT,
+						    node);
+			if (!dma->vbuf[i])
+				return -ENOMEM;
+			dma->pbuf[i] = dma_map_single(&pdev->dev, dma->vbuf[i],
+						      dma->size,
+						      ddb_dma_dir(dma));
+			if (dma_mapping_error(&pdev->dev, dma->pbuf[i])) {
+				kfree(dma->vbuf[i]);
+				dma->vbuf[i] = 0;
+				return -ENOMEM;
+			}
+			break;
+		case 2:
+			/* compound, ts_mmap() maps the single pages */
+			page = alloc_pages_node(node, GFP_KERNEL |
+						__GFP_REPEAT | __GFP_COMP,
+						get_order(dma->size));
+			if (!page)
+				return -ENOMEM;
+			dma->vbuf[i] = page_address(page);
+			dma->pbuf[i] = dma_map_page(&pdev->dev, page,
+						    0, dma->size,
+						    ddb_dma_dir(dma));
+			if (dma_mapping_error(&pdev->dev, dma->pbuf[i])) {
+				free_pages((unsigned long) dma->vbuf[i],
+					   get_order(dma->size));
+				dma->vbuf[i] = 0;
+				return -ENOMEM;
+			}
+			break;
+		default:
+			dma->vbuf[i] = pci_alloc_consistent(pdev, dma->size,
+							    &dma->pbuf[i]);
+			if (!dma->vbuf[i])
+				return -ENOMEM;
+			break;
 		}
 	}
 	return 0;
 }
-#else
 
-static void dma_free(struct pci_dev *pdev, struct ddb_dma *dma, int dir)
-{
-	int i;
+/* Control page for mmap readers, see include/linux/dvb/ci.h */
 
-	if (!dma)
+static void dma_ctrl_free(struct ddb_dma *dma)
+{
+	if (!dma || !dma->map)
 		return;
-	for (i = 0; i < dma->num; i++) {
-		if (dma->vbuf[i]) {
-			pci_free_consistent(pdev, dma->size,
-					    dma->vbuf[i], dma->pbuf[i]);
-			dma->vbuf[i] = 0;
-		}
-	}
+	free_page((unsigned long) dma->map);
+	dma->map = 0;
 }
 
-static int dma_alloc(struct pci_dev *pdev, struct ddb_dma *dma, int dir)
+static int dma_ctrl_alloc(struct ddb_dma *dma)
 {
-	int i;
-
 	if (!dma)
 		return 0;
-	for (i = 0; i < dma->num; i++) {
-		dma->vbuf[i] = pci_alloc_consistent(pdev, dma->size,
-						    &dma->pbuf[i]);
-		if (!dma->vbuf[i])
-			return -ENOMEM;
-	}
+	dma->map = (struct dvb_ci_dma_ctrl *) get_zeroed_page(GFP_KERNEL);
+	if (!dma->map)
+		return -ENOMEM;
+	dma->map->num = dma->num;
+	dma->map->size = dma->size;
+	dma->map->stride = PAGE_ALIGN(dma->size);
 	return 0;
 }
-#endif
 
 static int ddb_buffers_alloc(struct ddb *dev)
 {
@@ -271,6 +552,8 @@ static int ddb_buffers_alloc(struct ddb *dev)
 		port = &dev->port[i];
 		switch (port->class) {
 		case DDB_PORT_TUNER:
+			if (dma_lazy)
+				break;
 			if (dma_alloc(dev->pdev, port->input[0]->dma, 0) < 0)
 				return -1;
 			if (dma_alloc(dev->pdev, port->input[1]->dma, 0) < 0)
@@ -278,9 +561,15 @@ static int ddb_buffers_alloc(struct ddb *dev)
 			break;
 		case DDB_PORT_CI:
 		case DDB_PORT_LOOP:
+			if (dma_ctrl_alloc(port->input[0]->dma) < 0)
+				return -1;
+			if (dma_lazy)
+				break;
 			if (dma_alloc(dev->pdev, port->input[0]->dma, 0) < 0)
 				return -1;
 		case DDB_PORT_MOD:
+			if (dma_lazy)
+				break;
 			if (dma_alloc(dev->pdev, port->output->dma, 1) < 0)
 				return -1;
 			break;
@@ -288,6 +577,13 @@ static int ddb_buffers_alloc(struct ddb *dev)
 			break;
 		}
 	}
+	for (i = 0; i < DDB_MAX_INPUT + DDB_MAX_OUTPUT; i++) {
+		if (!dev->dma[i].io)
+			continue;
+		dev->dma[i].pstat = alloc_percpu(struct ddb_dma_stat);
+		if (!dev->dma[i].pstat)
+			return -1;
+	}
 	ddb_set_dma_tables(dev);
 	return 0;
 }
@@ -297,11 +593,20 @@ static void ddb_buffers_free(struct ddb *dev)
 	int i;
 	struct ddb_port *port;
 
+	for (i = 0; i < DDB_MAX_INPUT + DDB_MAX_OUTPUT; i++) {
+		if (dev->dma[i].io)
+			cancel_delayed_work_sync(&dev->dma[i].idle_work);
+		free_percpu(dev->dma[i].pstat);
+		dev->dma[i].pstat = 0;
+	}
+
 	for (i = 0; i < dev->info->port_num; i++) {
 		port = &dev->port[i];
 
-		if (port->input[0])
+		if (port->input[0]) {
+			dma_ctrl_free(port->input[0]->dma);
 			dma_free(dev->pdev, port->input[0]->dma, 0);
+		}
 		if (port->input[1])
 			dma_free(dev->pdev, port->input[1]->dma, 0);
 		if (port->output)
@@ -309,6 +614,154 @@ static void ddb_buffers_free(struct ddb *dev)
 	}
 }
 
+/* With dma_lazy the buffers of a channel are allocated by the first user.
+   This has to happen where we may sleep, i.e. on open, feed start and
+   redirect, not in ddb_input_start()/ddb_output_start() which run under
+   the DMA spinlock or rcu_read_lock().
+   Every user of a channel holds a reference from ddb_dma_get() until it
+   has stopped it. Buffers are only freed or changed without users, and
+   not while the channel is part of a redirect, see ddb_dma_redirected(). */
+
+static int ddb_dma_get(struct ddb *dev, struct ddb_dma *dma)
+{
+	struct ddb_input *input;
+	struct ddb_output *output;
+	int own = 1, ret = 0;
+
+	if (!dma)
+		return 0;
+	cancel_delayed_work_sync(&dma->idle_work);
+	mutex_lock(&dma->buf_lock);
+	if (dma->vbuf[0])
+		goto out;
+	ret = dma_alloc(dev->pdev, dma, dma->dir);
+	if (ret < 0) {
+		dma_free(dev->pdev, dma, dma->dir);
+		goto fail;
+	}
+	/* redirected inputs and fan-out outputs use other buffers */
+	if (dma->dir) {
+		output = dma->io;
+		if (output->redi && output->redi->redo != output)
+			own = 0;
+	} else {
+		input = dma->io;
+		if (input->redo)
+			own = 0;
+	}
+	if (own)
+		ddb_set_dma_table(dev, dma);
+out:
+	dma->users++;
+fail:
+	mutex_unlock(&dma->buf_lock);
+	return ret;
+}
+
+static void ddb_dma_idle(struct ddb_dma *dma)
+{
+	if (dma && dma_lazy && dma_idle)
+		schedule_delayed_work(&dma->idle_work, dma_idle * HZ);
+}
+
+static void ddb_dma_put(struct ddb_dma *dma)
+{
+	if (!dma)
+		return;
+	mutex_lock(&dma->buf_lock);
+	if (dma->users && !--dma->users)
+		ddb_dma_idle(dma);
+	mutex_unlock(&dma->buf_lock);
+}
+
+/* call with redirect_lock held */
+static int ddb_dma_redirected(struct ddb_dma *dma)
+{
+	struct ddb_input *input;
+
+	if (dma->dir)
+		return ((struct ddb_output *) dma->io)->redi ? 1 : 0;
+	input = dma->io;
+	return (input->redo || input->redi) ? 1 : 0;
+}
+
+static void ddb_dma_idle_work(struct work_struct *work)
+{
+	struct ddb_dma *dma = container_of(work, struct ddb_dma,
+					   idle_work.work);
+	struct ddb *dev;
+
+	/* ddb_redirect() waits for us with redirect_lock held */
+	if (!mutex_trylock(&redirect_lock)) {
+		ddb_dma_idle(dma);
+		return;
+	}
+	if (dma->dir)
+		dev = ((struct ddb_output *) dma->io)->port->dev;
+	else
+		dev = ((struct ddb_input *) dma->io)->port->dev;
+	mutex_lock(&dma->buf_lock);
+	if (!dma->users && !ddb_dma_redirected(dma))
+		dma_free(dev->pdev, dma, dma->dir);
+	mutex_unlock(&dma->buf_lock);
+	mutex_unlock(&redirect_lock);
+}
+
+/* Change number, size and IRQ divisor of the DMA blocks of a channel
+   without users which is not redirected, call with redirect_lock held.
+   The buffers are reallocated if they were allocated before. If neither
+   the new nor the old geometry can be allocated the channel is left
+   without buffers, ddb_input_start() refuses it then and ddb_dma_get()
+   tries again. */
+
+static int ddb_dma_reconfig(struct ddb *dev, struct ddb_dma *dma, int dir,
+			    u32 num, u32 size, u32 div)
+{
+	u32 onum = dma->num, osize = dma->size, odiv = dma->div;
+	int alloced, ret = 0;
+
+	if (num < 2 || num > DMA_MAX_NUM)
+		return -EINVAL;
+	if (!size || size % (128 * 47) || (size >> 7) > 0x7ff)
+		return -EINVAL;
+	if (!div || div > num)
+		return -EINVAL;
+	mutex_lock(&dma->buf_lock);
+	alloced = dma->vbuf[0] ? 1 : 0;
+	if (dma->users || ddb_dma_redirected(dma)) {
+		mutex_unlock(&dma->buf_lock);
+		return -EBUSY;
+	}
+
+	dma->wm = 188;
+	if (alloced)
+		dma_free(dev->pdev, dma, dir);
+	dma->num = num;
+	dma->size = size;
+	dma->div = div;
+	if (alloced && dma_alloc(dev->pdev, dma, dir) < 0) {
+		dma_free(dev->pdev, dma, dir);
+		dma->num = onum;
+		dma->size = osize;
+		dma->div = odiv;
+		if (dma_alloc(dev->pdev, dma, dir) < 0) {
+			dma_free(dev->pdev, dma, dir);
+			pr_err("DDBridge: lost DMA buffers of channel %d\n",
+			       dma->nr);
+		}
+		ret = -ENOMEM;
+	}
+	if (dma->map) {
+		dma->map->num = dma->num;
+		dma->map->size = dma->size;
+		dma->map->stride = PAGE_ALIGN(dma->size);
+	}
+	if (dma->vbuf[0])
+		ddb_set_dma_table(dev, dma);
+	mutex_unlock(&dma->buf_lock);
+	return ret;
+}
+
 static void ddb_output_start(struct ddb_output *output)
 {
 	struct ddb *dev = output->port->dev;
@@ -322,6 +775,7 @@ static void ddb_output_start(struct ddb_output *output)
 		output->dma->cbuf = 0;
 		output->dma->coff = 0;
 		output->dma->stat = 0;
+		output->dma->sidx = 0;
 		ddbwritel(dev, 0, DMA_BUFFER_CONTROL(output->dma->nr));
 	}
 	if (output->port->class == DDB_PORT_MOD)
@@ -388,15 +842,32 @@ static void ddb_input_stop(struct ddb_input *input)
 	/*pr_info("input_stop %d.%d\n", dev->nr, input->nr);*/
 }
 
-static void ddb_input_start(struct ddb_input *input)
+static int ddb_input_start(struct ddb_input *input)
 {
 	struct ddb *dev = input->port->dev;
+	struct ddb_dma *bdma;
 
 	if (input->dma) {
+		/* the buffers the DMA writes into, see ddb_redirect_dma() */
+		bdma = input->redo ? input->redo->dma : input->dma;
+		if (!bdma->vbuf[0]) {
+			pr_err("DDBridge: input %d.%d has no DMA buffers\n",
+			       dev->nr, input->nr);
+			return -ENOMEM;
+		}
 		spin_lock_irq(&input->dma->lock);
 		input->dma->cbuf = 0;
 		input->dma->coff = 0;
 		input->dma->stat = 0;
+		input->dma->sidx = 0;
+		input->dma->sseq = 0;
+		if (input->dma->map) {
+			input->dma->map->cur = 0;
+			input->dma->map->ctrl = 0;
+			input->dma->map->ack = 0;
+			memset(input->dma->map->stamp, 0,
+			       sizeof(input->dma->map->stamp));
+		}
 		ddbwritel(dev, 0, DMA_BUFFER_CONTROL(input->dma->nr));
 	}
 	ddbwritel(dev, 0, TS_INPUT_CONTROL2(input->nr));
@@ -420,15 +891,51 @@ static void ddb_input_start(struct ddb_input *input)
 		spin_unlock_irq(&input->dma->lock);
 	}
 	/*pr_info("input_start %d.%d\n", dev->nr, input->nr);*/
+	return 0;
 }
 
+/* The first user of an input takes its DMA buffers, unless it is
+   redirected and writes into the buffers of the output. */
+
+static int ddb_dvb_dma_get(struct ddb_input *input)
+{
+	struct ddb_dvb *dvb = &input->port->dvb[input->nr & 1];
+	int ret;
+
+	if (dvb->users || input->redo)
+		return 0;
+	ret = ddb_dma_get(input->port->dev, input->dma);
+	if (ret < 0)
+		return ret;
+	dvb->dma_held = 1;
+	return 0;
+}
+
+static void ddb_dvb_dma_put(struct ddb_input *input)
+{
+	struct ddb_dvb *dvb = &input->port->dvb[input->nr & 1];
+
+	if (dvb->users || !dvb->dma_held)
+		return;
+	dvb->dma_held = 0;
+	ddb_dma_put(input->dma);
+}
 
 static int ddb_dvb_input_start(struct ddb_input *input)
 {
 	struct ddb_dvb *dvb = &input->port->dvb[input->nr & 1];
+	int ret;
 
-	if (!dvb->users)
-		ddb_input_start(input);
+	if (!dvb->users) {
+		ret = ddb_dvb_dma_get(input);
+		if (ret < 0)
+			return ret;
+		ret = ddb_input_start(input);
+		if (ret < 0) {
+			ddb_dvb_dma_put(input);
+			return ret;
+		}
+	}
 
 	return ++dvb->users;
 }
@@ -441,39 +948,54 @@ static int ddb_dvb_input_stop(struct ddb_input *input)
 		return dvb->users;
 
 	ddb_input_stop(input);
+	ddb_dvb_dma_put(input);
 	return 0;
 }
 
-static void ddb_input_start_all(struct ddb_input *input)
+static void ddb_chain_start(struct ddb_chain *c)
 {
-	struct ddb_input *i = input;
-	struct ddb_output *o;
+	u32 i;
 
-	mutex_lock(&redirect_lock);
-	while (i && (o = i->redo)) {
-		ddb_output_start(o);
-		i = o->port->input[0];
-		if (i)
-			ddb_input_start(i);
-	}
-	ddb_input_start(input);
-	mutex_unlock(&redirect_lock);
+	for (i = 0; i < c->num; i++)
+		if (c->out[i])
+			ddb_output_start(c->io[i]);
+		else
+			ddb_input_start(c->io[i]);
+}
+
+static void ddb_chain_stop(struct ddb_chain *c)
+{
+	u32 i;
+
+	for (i = 0; i < c->num; i++)
+		if (c->out[i])
+			ddb_output_stop(c->io[i]);
+		else
+			ddb_input_stop(c->io[i]);
+}
+
+static int ddb_input_start_all(struct ddb_input *input)
+{
+	struct ddb_chain *c;
+
+	rcu_read_lock();
+	c = rcu_dereference(input->chain);
+	if (c)
+		ddb_chain_start(c);
+	rcu_read_unlock();
+	return ddb_input_start(input);
 }
 
 static void ddb_input_stop_all(struct ddb_input *input)
 {
-	struct ddb_input *i = input;
-	struct ddb_output *o;
+	struct ddb_chain *c;
 
-	mutex_lock(&redirect_lock);
 	ddb_input_stop(input);
-	while (i && (o = i->redo)) {
-		ddb_output_stop(o);
-		i = o->port->input[0];
-		if (i)
-			ddb_input_stop(i);
-	}
-	mutex_unlock(&redirect_lock);
+	rcu_read_lock();
+	c = rcu_dereference(input->chain);
+	if (c)
+		ddb_chain_stop(c);
+	rcu_read_unlock();
 }
 
 static u32 ddb_output_free(struct ddb_output *output)
@@ -515,6 +1037,23 @@ static u32 ddb_dma_free(struct ddb_dma *dma)
 }
 #endif
 
+/* free bytes for the writer, from the position of the last IRQ */
+
+static u32 ddb_output_space(struct ddb_output *output)
+{
+	struct ddb_dma *dma = output->dma;
+	u32 stat = dma->stat;
+	s32 diff;
+
+	if (ddb_output_free(output) < 188)
+		return 0;
+	diff = ((stat >> 11) & 0x1f) * dma->size + ((stat & 0x7ff) << 7) -
+		(dma->cbuf * dma->size + dma->coff);
+	if (diff <= 0)
+		diff += dma->num * dma->size;
+	return diff;
+}
+
 static ssize_t ddb_output_write(struct ddb_output *output,
 				const u8 *buf, size_t count)
 {
@@ -548,12 +1087,8 @@ static ssize_t ddb_output_write(struct ddb_output *output,
 				   output->dma->coff,
 				   buf, len))
 			return -EIO;
-#ifdef DDB_ALT_DMA
-		dma_sync_single_for_device(dev->dev,
-					   output->dma->pbuf[
-						   output->dma->cbuf],
-					   output->dma->size, DMA_TO_DEVICE);
-#endif
+		ddb_dma_sync_dev(dev, output->dma, output->dma->cbuf,
+				 output->dma->coff, len);
 		left -= len;
 		buf += len;
 		output->dma->coff += len;
@@ -645,23 +1180,44 @@ static u32 ddb_output_ok(struct ddb_output *output)
 }
 #endif
 
+/* bytes in completed blocks not read yet, from the position and
+   control of the last IRQ */
+
+static u32 ddb_dma_avail(struct ddb_dma *dma)
+{
+	u32 idx = (dma->stat >> 11) & 0x1f;
+
+	if (dma->cbuf == idx)
+		return 0;
+	return ((idx + dma->num - dma->cbuf) % dma->num) * dma->size -
+		dma->coff;
+}
+
 static u32 ddb_input_avail(struct ddb_input *input)
 {
 	struct ddb *dev = input->port->dev;
-	u32 idx, off, stat = input->dma->stat;
-	u32 ctrl = ddbreadl(dev, DMA_BUFFER_CONTROL(input->dma->nr));
+	struct ddb_dma *dma = input->dma;
+	u32 idx, off, stat = dma->stat;
 
 	idx = (stat >> 11) & 0x1f;
 	off = (stat & 0x7ff) << 7;
 
-	if (ctrl & 4) {
-		pr_err("IA %d %d %08x\n", idx, off, ctrl);
-		ddbwritel(dev, stat, DMA_BUFFER_ACK(input->dma->nr));
+	if (dma->ctrl & 4) {
+		pr_err("IA %d %d %08x\n", idx, off, dma->ctrl);
+		ddbwritel(dev, stat, DMA_BUFFER_ACK(dma->nr));
+		dma->ctrl &= ~4;
 		return 0;
 	}
-	if (input->dma->cbuf != idx)
-		return 188;
-	return 0;
+	return ddb_dma_avail(dma);
+}
+
+static u32 ddb_dma_wm(struct ddb_dma *dma, u32 wm)
+{
+	u32 max = (dma->num - 1) * dma->size;
+
+	if (!wm)
+		wm = 188;
+	return wm > max ? max : wm;
 }
 
 static size_t ddb_input_read(struct ddb_input *input, u8 *buf, size_t count)
@@ -680,13 +1236,12 @@ static size_t ddb_input_read(struct ddb_input *input, u8 *buf, size_t count)
 		free = input->dma->size - input->dma->coff;
 		if (free > left)
 			free = left;
-#ifdef DDB_ALT_DMA
-		dma_sync_single_for_cpu(dev->dev,
-					input->dma->pbuf[input->dma->cbuf],
-					input->dma->size, DMA_FROM_DEVICE);
-#endif
+		ddb_dma_sync_cpu(dev, input->dma, input->dma->cbuf,
+				 input->dma->coff, free);
 		ret = copy_to_user(buf, input->dma->vbuf[input->dma->cbuf] +
 				   input->dma->coff, free);
+		ddb_dma_sync_dev(dev, input->dma, input->dma->cbuf,
+				 input->dma->coff, free);
 		if (ret)
 			return -EFAULT;
 		input->dma->coff += free;
@@ -696,6 +1251,8 @@ static size_t ddb_input_read(struct ddb_input *input, u8 *buf, size_t count)
 				input->dma->num;
 		}
 		left -= free;
+		if (input->dma->map)
+			input->dma->map->ack = input->dma->cbuf;
 		ddbwritel(dev,
 			  (input->dma->cbuf << 11) | (input->dma->coff >> 7),
 			  DMA_BUFFER_ACK(input->dma->nr));
@@ -703,6 +1260,32 @@ static size_t ddb_input_read(struct ddb_input *input, u8 *buf, size_t count)
 	return count;
 }
 
+/* Return all blocks up to idx to the hardware.
+   Used by mmap readers which consume the DMA buffers in place.
+   idx must lie in the completed range (cbuf, hardware index] of the ring,
+   the blocks beyond it are still owned by the device.
+   Called with dma->lock held. */
+
+static int ddb_input_ack(struct ddb_input *input, u32 idx)
+{
+	struct ddb *dev = input->port->dev;
+	struct ddb_dma *dma = input->dma;
+	u32 hw = (dma->stat >> 11) & 0x1f;
+
+	if (idx >= dma->num || idx == dma->cbuf ||
+	    (idx + dma->num - dma->cbuf) % dma->num >
+	    (hw + dma->num - dma->cbuf) % dma->num)
+		return -EINVAL;
+	for (; dma->mode && dma->cbuf != idx;
+	     dma->cbuf = (dma->cbuf + 1) % dma->num)
+		ddb_dma_sync_dev(dev, dma, dma->cbuf, 0, dma->size);
+	dma->cbuf = idx;
+	dma->coff = 0;
+	dma->map->ack = idx;
+	ddbwritel(dev, idx << 11, DMA_BUFFER_ACK(dma->nr));
+	return 0;
+}
+
 /****************************************************************************/
 /****************************************************************************/
 
@@ -748,12 +1331,13 @@ static ssize_t ts_read(struct file *file, char *buf,
 	if (!dev->has_dma)
 		return -EINVAL;
 	while (left) {
-		if (ddb_input_avail(input) < 188) {
+		if (ddb_input_avail(input) < input->dma->wm) {
 			if (file->f_flags & O_NONBLOCK)
 				break;
 			if (wait_event_interruptible(
 				    input->dma->wq,
-				    ddb_input_avail(input) >= 188) < 0)
+				    ddb_input_avail(input) >=
+				    input->dma->wm) < 0)
 				break;
 		}
 		stat = ddb_input_read(input, buf, left);
@@ -775,13 +1359,156 @@ static unsigned int ts_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &input->dma->wq, wait);
 	poll_wait(file, &output->dma->wq, wait);
-	if (ddb_input_avail(input) >= 188)
+	if (ddb_input_avail(input) >= input->dma->wm)
 		mask |= POLLIN | POLLRDNORM;
-	if (ddb_output_free(output) >= 188)
+	if (ddb_output_space(output) >= output->dma->wm)
 		mask |= POLLOUT | POLLWRNORM;
 	return mask;
 }
 
+/* Map the control page (offset 0) or the input DMA blocks (offset
+   one page, each block at a multiple of stride), both read-only.
+   Blocks are given back with CI_DMA_ACK. Coherent buffers are mapped
+   with dma_mmap_coherent() block by block, page backed ones page by
+   page, kmalloc()ed ones (dma_mode=1) are not page aligned and can not
+   be mapped. The open file holds a DMA user, so the buffers stay
+   allocated as long as they are mapped. */
+
+static int ts_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct dvb_device *dvbdev = file->private_data;
+	struct ddb_output *output = dvbdev->priv;
+	struct ddb_input *input = output->port->input[0];
+	unsigned long start = vma->vm_start, end = vma->vm_end;
+	unsigned long size = end - start;
+	struct ddb_dma *dma;
+	struct ddb *dev;
+	u32 i, j, stride;
+	int ret = 0;
+
+	if ((file->f_flags & O_ACCMODE) != O_RDONLY)
+		return -EINVAL;
+	if (!input || !input->dma || !input->dma->map)
+		return -ENODEV;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	dev = input->port->dev;
+	dma = input->dma;
+	stride = dma->map->stride;
+
+	if (vma->vm_pgoff == 0) {
+		if (size != PAGE_SIZE)
+			return -EINVAL;
+		return vm_insert_page(vma, start, virt_to_page(dma->map));
+	}
+	if (vma->vm_pgoff != 1 || size != dma->num * stride)
+		return -EINVAL;
+
+	mutex_lock(&dma->buf_lock);
+	if (!dma->vbuf[0]) {
+		ret = -ENODEV;
+		goto out;
+	}
+	switch (dma->mode) {
+	case 0:
+		for (i = 0; i < dma->num && !ret; i++) {
+			vma->vm_start = start + i * stride;
+			vma->vm_end = vma->vm_start + stride;
+			vma->vm_pgoff = 0;
+			ret = dma_mmap_coherent(dev->dev, vma, dma->vbuf[i],
+						dma->pbuf[i], dma->size);
+		}
+		vma->vm_start = start;
+		vma->vm_end = end;
+		vma->vm_pgoff = 1;
+		break;
+	case 2:
+		for (i = 0; i < dma->num && !ret; i++)
+			for (j = 0; j < stride && !ret; j += PAGE_SIZE)
+				ret = vm_insert_page(vma, start + i * stride + j,
+						     virt_to_page(dma->vbuf[i] + j));
+		break;
+	default:
+		ret = -ENODEV;
+		break;
+	}
+out:
+	mutex_unlock(&dma->buf_lock);
+	return ret;
+}
+
+static int ts_do_ioctl(struct file *file, unsigned int cmd, void *parg)
+{
+	struct dvb_device *dvbdev = file->private_data;
+	struct ddb_output *output = dvbdev->priv;
+	struct ddb_input *input = output->port->input[0];
+	int ret = 0;
+
+	switch (cmd) {
+	case CI_DMA_ACK:
+	{
+		u32 idx = *(u32 *) parg;
+
+		if (!input || !input->dma || !input->dma->map)
+			return -ENODEV;
+		spin_lock_irq(&input->dma->lock);
+		ret = ddb_input_ack(input, idx);
+		spin_unlock_irq(&input->dma->lock);
+		break;
+	}
+	case CI_GET_STAMPS:
+	{
+		struct dvb_ci_dma_stamps *st = parg;
+
+		if (!input || !input->dma || !input->dma->map)
+			return -ENODEV;
+		spin_lock_irq(&input->dma->lock);
+		st->num = input->dma->num;
+		st->res = 0;
+		memcpy(st->stamp, input->dma->map->stamp, sizeof(st->stamp));
+		spin_unlock_irq(&input->dma->lock);
+		break;
+	}
+	case CI_SET_WATERMARK:
+	{
+		struct dvb_ci_watermark *wm = parg;
+		int acc = file->f_flags & O_ACCMODE;
+
+		/* a reader sets rx, a writer tx, O_RDWR both */
+		if ((acc == O_RDONLY && wm->tx) || (acc == O_WRONLY && wm->rx))
+			return -EINVAL;
+		if (!output->dma)
+			return -ENODEV;
+		if (acc != O_WRONLY && input && input->dma)
+			input->dma->wm = ddb_dma_wm(input->dma, wm->rx);
+		if (acc != O_RDONLY)
+			output->dma->wm = ddb_dma_wm(output->dma, wm->tx);
+		break;
+	}
+	case CI_GET_WATERMARK:
+	{
+		struct dvb_ci_watermark *wm = parg;
+
+		if (!output->dma)
+			return -ENODEV;
+		wm->rx = (input && input->dma) ? input->dma->wm : 0;
+		wm->tx = output->dma->wm;
+		break;
+	}
+	default:
+		ret = -ENOTTY;
+		break;
+	}
+	return ret;
+}
+
+static long ts_ioctl(struct file *file,
+		     unsigned int cmd, unsigned long arg)
+{
+	return dvb_usercopy(file, cmd, arg, ts_do_ioctl);
+}
+
 static int ts_release(struct inode *inode, struct file *file)
 {
 	struct dvb_device *dvbdev = file->private_data;
@@ -792,10 +1519,11 @@ static int ts_release(struct inode *inode, struct file *file)
 		if (!input)
 			return -EINVAL;
 		ddb_input_stop(input);
-	} else if ((file->f_flags & O_ACCMODE) == O_WRONLY) {
-		if (!output)
-			return -EINVAL;
-		ddb_output_stop(output);
+		ddb_dma_put(input->dma);
+	} else {
+		if ((file->f_flags & O_ACCMODE) == O_WRONLY)
+			ddb_output_stop(output);
+		ddb_dma_put(output->dma);
 	}
 	return dvb_generic_release(inode, file);
 }
@@ -806,6 +1534,7 @@ static int ts_open(struct inode *inode, struct file *file)
 	struct dvb_device *dvbdev = file->private_data;
 	struct ddb_output *output = dvbdev->priv;
 	struct ddb_input *input = output->port->input[0];
+	struct ddb_dma *dma;
 
 	if ((file->f_flags & O_ACCMODE) == O_RDONLY) {
 		if (!input)
@@ -816,13 +1545,30 @@ static int ts_open(struct inode *inode, struct file *file)
 		if (!output)
 			return -EINVAL;
 	}
-	err = dvb_generic_open(inode, file);
+	dma = (file->f_flags & O_ACCMODE) == O_RDONLY ?
+		input->dma : output->dma;
+	err = ddb_dma_get(output->port->dev, dma);
 	if (err < 0)
 		return err;
-	if ((file->f_flags & O_ACCMODE) == O_RDONLY)
-		ddb_input_start(input);
-	else if ((file->f_flags & O_ACCMODE) == O_WRONLY)
+	err = dvb_generic_open(inode, file);
+	if (err < 0) {
+		ddb_dma_put(dma);
+		return err;
+	}
+	if ((file->f_flags & O_ACCMODE) == O_RDONLY) {
+		if (input->dma)
+			input->dma->wm = 188;
+		err = ddb_input_start(input);
+		if (err < 0) {
+			dvb_generic_release(inode, file);
+			ddb_dma_put(dma);
+			return err;
+		}
+	} else if ((file->f_flags & O_ACCMODE) == O_WRONLY) {
+		if (output->dma)
+			output->dma->wm = 188;
 		ddb_output_start(output);
+	}
 	return err;
 }
 
@@ -835,6 +1581,7 @@ static int mod_release(struct inode *inode, struct file *file)
 		if (!output)
 			return -EINVAL;
 		ddb_output_stop(output);
+		ddb_dma_put(output->dma);
 	}
 	return dvb_generic_release(inode, file);
 }
@@ -848,10 +1595,16 @@ static int mod_open(struct inode *inode, struct file *file)
 	if ((file->f_flags & O_ACCMODE) == O_WRONLY) {
 		if (!output)
 			return -EINVAL;
+		err = ddb_dma_get(output->port->dev, output->dma);
+		if (err < 0)
+			return err;
 	}
 	err = dvb_generic_open(inode, file);
-	if (err < 0)
+	if (err < 0) {
+		if ((file->f_flags & O_ACCMODE) == O_WRONLY)
+			ddb_dma_put(output->dma);
 		return err;
+	}
 	if ((file->f_flags & O_ACCMODE) == O_WRONLY)
 		ddb_output_start(output);
 	return err;
@@ -863,7 +1616,8 @@ static const struct file_operations ci_fops = {
 	.open    = ts_open,
 	.release = ts_release,
 	.poll    = ts_poll,
-	.mmap    = 0,
+	.mmap    = ts_mmap,
+	.unlocked_ioctl = ts_ioctl,
 };
 
 static struct dvb_device dvbdev_ci = {
@@ -922,10 +1676,14 @@ static int locked_gate_ctrl(struct dvb_frontend *fe, int enable)
 	struct ddb_input *input = fe->sec_priv;
 	struct ddb_port *port = input->port;
 	struct ddb_dvb *dvb = &port->dvb[input->nr & 1];
+	ktime_t start;
 	int status;
 
 	if (enable) {
+		start = ktime_get();
 		mutex_lock(&port->i2c_gate_lock);
+		atomic_inc(&port->i2c->stat.gate_lat[
+				   ddb_lat_bin(ktime_sub(ktime_get(), start))]);
 		status = dvb->gate_ctrl(fe, 1);
 	} else {
 		status = dvb->gate_ctrl(fe, 0);
@@ -1349,9 +2107,19 @@ static int start_feed(struct dvb_demux_feed *dvbdmxfeed)
 	struct dvb_demux *dvbdmx = dvbdmxfeed->demux;
 	struct ddb_input *input = dvbdmx->priv;
 	struct ddb_dvb *dvb = &input->port->dvb[input->nr & 1];
+	int ret;
 
-	if (!dvb->users)
-		ddb_input_start_all(input);
+	if (!dvb->users) {
+		ret = ddb_dvb_dma_get(input);
+		if (ret < 0)
+			return ret;
+		ret = ddb_input_start_all(input);
+		if (ret < 0) {
+			ddb_input_stop_all(input);
+			ddb_dvb_dma_put(input);
+			return ret;
+		}
+	}
 
 	return ++dvb->users;
 }
@@ -1366,6 +2134,7 @@ static int stop_feed(struct dvb_demux_feed *dvbdmxfeed)
 		return dvb->users;
 
 	ddb_input_stop_all(input);
+	ddb_dvb_dma_put(input);
 	return 0;
 }
 
@@ -2167,6 +2936,89 @@ static void ddb_ports_detach(struct ddb *dev)
 }
 
 
+/* Statistics, only called with dma->lock held or from the IRQ handler,
+   so the per CPU pointer stays valid. */
+
+static void ddb_dma_irq_stat(struct ddb_dma *dma)
+{
+	dma->irq_time = ktime_get();
+	if (!dma->pstat)
+		return;
+	this_cpu_inc(dma->pstat->irqs);
+}
+
+/* blocks since the last call, geometry from bufreg to be correct for
+   inputs redirected into output buffers */
+
+static u32 ddb_dma_stat(struct ddb_dma *dma, int overflow)
+{
+	struct ddb_dma_stat *ps;
+	u32 num = (dma->bufreg >> 11) & 0x1f;
+	u32 size = (dma->bufreg & 0x7ff) << 7;
+	u32 idx = (dma->stat >> 11) & 0x1f, n;
+
+	if (!num)
+		return 0;
+	n = (idx + num - dma->sidx) % num;
+	if (!n && overflow)
+		n = num;
+	dma->sidx = idx;
+	if (!dma->pstat)
+		return n;
+
+	ps = this_cpu_ptr(dma->pstat);
+	ps->blocks += n;
+	ps->bytes += (u64) n * size;
+	if (overflow)
+		ps->overflows++;
+	return n;
+}
+
+/* Stamp the n blocks completed before the current position with the
+   time of the IRQ for mmap and CI_GET_STAMPS readers. */
+
+static void ddb_dma_stamp(struct ddb_dma *dma, u32 n)
+{
+	struct dvb_ci_dma_stamp *st;
+	u32 idx = (dma->stat >> 11) & 0x1f;
+	u64 ns = ktime_to_ns(dma->irq_time);
+
+	if (n > dma->num)
+		n = dma->num;
+	for (; n; n--) {
+		st = &dma->map->stamp[(idx + dma->num - n) % dma->num];
+		st->ns = ns;
+		st->seq = dma->sseq++;
+	}
+}
+
+/* Hand the n blocks completed before the current position to the CPU
+   for mmap readers, ddb_input_ack() gives them back. */
+
+static void ddb_dma_sync_blocks(struct ddb *dev, struct ddb_dma *dma, u32 n)
+{
+	u32 idx = (dma->stat >> 11) & 0x1f;
+
+	if (!dma->mode)
+		return;
+	if (n > dma->num)
+		n = dma->num;
+	for (; n; n--)
+		ddb_dma_sync_cpu(dev, dma, (idx + dma->num - n) % dma->num,
+				 0, dma->size);
+}
+
+static void ddb_dma_work_stat(struct ddb_dma *dma, ktime_t start)
+{
+	struct ddb_dma_stat *ps;
+
+	if (!dma->pstat)
+		return;
+	ps = this_cpu_ptr(dma->pstat);
+	ps->irq_lat[ddb_lat_bin(ktime_sub(start, dma->irq_time))]++;
+	ps->work_lat[ddb_lat_bin(ktime_sub(ktime_get(), start))]++;
+}
+
 /* Copy input DMA pointers to output DMA and ACK. */
 
 static void input_write_output(struct ddb_input *input,
@@ -2178,11 +3030,38 @@ static void input_write_output(struct ddb_input *input,
 	output->dma->coff = (input->dma->stat & 0x7ff) << 7;
 }
 
+/* With fan-out the input may only advance up to the output which is
+   furthest behind it. All of them use the geometry of input->redo. */
+
+static u32 ddb_fan_stat(struct ddb_input *input)
+{
+	struct ddb_dma *dma = input->redo->dma;
+	u32 ring = dma->num * dma->size, pos, lag, max = 0, i;
+	u32 stat = dma->stat, ipos;
+
+	ipos = ((input->dma->stat >> 11) & 0x1f) * dma->size +
+		((input->dma->stat & 0x7ff) << 7);
+	for (i = 0; i <= input->fan_num; i++) {
+		dma = i ? input->fan[i - 1]->dma : input->redo->dma;
+		pos = ((dma->stat >> 11) & 0x1f) * input->redo->dma->size +
+			((dma->stat & 0x7ff) << 7);
+		lag = (ipos + ring - pos) % ring;
+		if (lag > max || !i) {
+			max = lag;
+			stat = dma->stat;
+		}
+	}
+	return stat;
+}
+
 static void output_ack_input(struct ddb_output *output,
 			     struct ddb_input *input)
 {
-	ddbwritel(input->port->dev,
-		  output->dma->stat, DMA_BUFFER_ACK(input->dma->nr));
+	u32 stat = output->dma->stat;
+
+	if (input->fan_num)
+		stat = ddb_fan_stat(input);
+	ddbwritel(input->port->dev, stat, DMA_BUFFER_ACK(input->dma->nr));
 }
 
 static void input_write_dvb(struct ddb_input *input,
@@ -2191,6 +3070,8 @@ static void input_write_dvb(struct ddb_input *input,
 	struct ddb_dvb *dvb = &input2->port->dvb[input2->nr & 1];
 	struct ddb_dma *dma, *dma2;
 	struct ddb *dev = input->port->dev;
+	const u8 *blk[DMA_MAX_BUFS];
+	u32 idx, i, n = 0;
 	int noack = 0;
 
 	dma = dma2 = input->dma;
@@ -2200,27 +3081,26 @@ static void input_write_dvb(struct ddb_input *input,
 		dma2 = input->redo->dma;
 		noack = 1;
 	}
-	while (dma->cbuf != ((dma->stat >> 11) & 0x1f)
-	       || (4 & dma->ctrl)) {
-		if (4 & dma->ctrl) {
-			/*pr_err("Overflow dma %d\n", dma->nr);*/
-			if (noack)
-				noack = 0;
-		}
-#ifdef DDB_ALT_DMA
-		dma_sync_single_for_cpu(dev->dev, dma2->pbuf[dma->cbuf],
-					dma2->size, DMA_FROM_DEVICE);
-#endif
-		dvb_dmx_swfilter_packets(&dvb->demux,
-					 dma2->vbuf[dma->cbuf],
-					 dma2->size / 188);
-		dma->cbuf = (dma->cbuf + 1) % dma2->num;
-		if (!noack)
-			ddbwritel(dev, (dma->cbuf << 11),
-				  DMA_BUFFER_ACK(dma->nr));
-		dma->stat = ddbreadl(dev, DMA_BUFFER_CURRENT(dma->nr));
-		dma->ctrl = ddbreadl(dev, DMA_BUFFER_CONTROL(dma->nr));
+	/* Use the position read by the caller for all completed blocks,
+	   after an overflow the whole ring is full. */
+	idx = (dma->stat >> 11) & 0x1f;
+	if (dma->cbuf == idx && !(4 & dma->ctrl))
+		return;
+	if (4 & dma->ctrl) {
+		/*pr_err("Overflow dma %d\n", dma->nr);*/
+		noack = 0;
 	}
+	do {
+		ddb_dma_sync_cpu(dev, dma2, dma->cbuf, 0, dma2->size);
+		blk[n++] = dma2->vbuf[dma->cbuf];
+		dma->cbuf = (dma->cbuf + 1) % dma2->num;
+	} while (dma->cbuf != idx && n < dma2->num);
+	dvb_dmx_swfilter_blocks(&dvb->demux, blk, n, dma2->size / 188);
+	for (i = 0; i < n; i++)
+		ddb_dma_sync_dev(dev, dma2, (idx + dma2->num - n + i) %
+				 dma2->num, 0, dma2->size);
+	if (!noack)
+		ddbwritel(dev, (dma->cbuf << 11), DMA_BUFFER_ACK(dma->nr));
 }
 
 #ifdef DDB_USE_WORK
@@ -2235,6 +3115,8 @@ static void input_tasklet(unsigned long data)
 	struct ddb_dma *dma = input->dma;
 #endif
 	struct ddb *dev = input->port->dev;
+	ktime_t start = ktime_get();
+	u32 i, n;
 
 	spin_lock(&dma->lock);
 	if (!dma->running) {
@@ -2243,31 +3125,74 @@ static void input_tasklet(unsigned long data)
 	}
 	dma->stat = ddbreadl(dev, DMA_BUFFER_CURRENT(dma->nr));
 	dma->ctrl = ddbreadl(dev, DMA_BUFFER_CONTROL(dma->nr));
+	n = ddb_dma_stat(dma, dma->ctrl & 4);
+	if (dma->map) {
+		ddb_dma_stamp(dma, n);
+		ddb_dma_sync_blocks(dev, dma, n);
+	}
 
 #if 0
 	if (4 & dma->ctrl)
 		pr_err("Overflow dma %d\n", dma->nr);
 #endif
+	if (dma->map) {
+		dma->map->cur = dma->stat;
+		dma->map->ctrl = dma->ctrl;
+	}
 	if (input->redi)
 		input_write_dvb(input, input->redi);
 	if (input->redo)
 		input_write_output(input, input->redo);
-	wake_up(&dma->wq);
+	for (i = 0; i < input->fan_num; i++)
+		input_write_output(input, input->fan[i]);
+	if ((dma->ctrl & 4) || ddb_dma_avail(dma) >= dma->wm)
+		wake_up(&dma->wq);
+	ddb_dma_work_stat(dma, start);
 	spin_unlock(&dma->lock);
 }
 
+#ifdef DDB_USE_WORK
+/* Demux work of an input runs on one CPU of its mask, inputs sharing a
+   mask are spread over its CPUs. An empty mask keeps the work on the
+   CPU which took the IRQ. */
+
+static void ddb_dma_set_cpus(struct ddb_dma *dma, const struct cpumask *mask)
+{
+	int i, cpu = -1, n = cpumask_weight(mask);
+
+	cpumask_copy(&dma->cpus, mask);
+	if (n) {
+		cpu = cpumask_first(mask);
+		for (i = 0; i < dma->nr % n; i++)
+			cpu = cpumask_next(cpu, mask);
+	}
+	dma->cpu = cpu;
+}
+
+static void ddb_dma_queue_work(struct ddb_dma *dma)
+{
+	int cpu = ACCESS_ONCE(dma->cpu);
+
+	if (cpu >= 0 && cpu_online(cpu))
+		queue_work_on(cpu, ddb_wq, &dma->work);
+	else
+		queue_work(ddb_wq, &dma->work);
+}
+#endif
+
 static void input_handler(unsigned long data)
 {
 	struct ddb_input *input = (struct ddb_input *) data;
 	struct ddb_dma *dma = input->dma;
 
+	ddb_dma_irq_stat(dma);
 
 	/* If there is no input connected, input_tasklet() will
 	   just copy pointers and ACK. So, there is no need to go
 	   through the tasklet scheduler. */
 #ifdef DDB_USE_WORK
 	if (input->redi)
-		queue_work(ddb_wq, &dma->work);
+		ddb_dma_queue_work(dma);
 	else
 		input_work(&dma->work);
 #else
@@ -2297,6 +3222,7 @@ static void output_handler(unsigned long data)
 	struct ddb_dma *dma = output->dma;
 	struct ddb *dev = output->port->dev;
 
+	ddb_dma_irq_stat(dma);
 	spin_lock(&dma->lock);
 	if (!dma->running) {
 		spin_unlock(&dma->lock);
@@ -2304,9 +3230,11 @@ static void output_handler(unsigned long data)
 	}
 	dma->stat = ddbreadl(dev, DMA_BUFFER_CURRENT(dma->nr));
 	dma->ctrl = ddbreadl(dev, DMA_BUFFER_CONTROL(dma->nr));
+	ddb_dma_stat(dma, 0);
 	if (output->redi)
 		output_ack_input(output, output->redi);
-	wake_up(&dma->wq);
+	if (ddb_output_space(output) >= dma->wm)
+		wake_up(&dma->wq);
 	spin_unlock(&dma->lock);
 }
 
@@ -2323,6 +3251,11 @@ static void ddb_dma_init(struct ddb_dma *dma, int nr, void *io, int out)
 
 	dma->io = io;
 	dma->nr = nr;
+	dma->dir = out;
+	dma->mode = (dma_mode >= 0 && dma_mode <= 2) ? dma_mode : 0;
+	dma->wm = 188;
+	mutex_init(&dma->buf_lock);
+	INIT_DELAYED_WORK(&dma->idle_work, ddb_dma_idle_work);
 	spin_lock_init(&dma->lock);
 	init_waitqueue_head(&dma->wq);
 	if (out) {
@@ -2337,6 +3270,8 @@ static void ddb_dma_init(struct ddb_dma *dma, int nr, void *io, int out)
 	} else {
 #ifdef DDB_USE_WORK
 		INIT_WORK(&dma->work, input_work);
+		cpumask_clear(&dma->cpus);
+		dma->cpu = -1;
 #else
 		tasklet_init(&dma->tasklet, input_tasklet, priv);
 #endif
@@ -2361,6 +3296,10 @@ static void ddb_input_init(struct ddb_port *port, int nr, int pnr, int dma_nr)
 	if (dev->has_dma) {
 		input->dma = &dev->dma[dma_nr];
 		ddb_dma_init(input->dma, dma_nr, (void *) input, 0);
+#ifdef DDB_USE_WORK
+		if (ddb_node_cpus(dev))
+			ddb_dma_set_cpus(input->dma, ddb_node_cpus(dev));
+#endif
 	}
 	ddbwritel(dev, 0, TS_INPUT_CONTROL(nr));
 	ddbwritel(dev, 2, TS_INPUT_CONTROL(nr));
@@ -2396,10 +3335,58 @@ static void ddb_output_init(struct ddb_port *port, int nr, int dma_nr)
 		ddbwritel(dev, 0, DMA_BUFFER_ACK(output->dma->nr));
 }
 
+static void ddb_irq_poll(unsigned long data);
+
+static void ddb_irq_mod_init(struct ddb *dev)
+{
+	struct ddb_irq_mod *mod = &dev->irq_mod;
+
+	spin_lock_init(&mod->lock);
+	setup_timer(&mod->timer, ddb_irq_poll, (unsigned long) dev);
+	mod->high = dev->has_dma ? irq_mod_high : 0;
+	mod->interval = irq_mod_interval > 0 ? irq_mod_interval : 1;
+	mod->idle = irq_mod_idle > 0 ? irq_mod_idle : 1;
+	mod->budget = irq_mod_budget > 0 ? irq_mod_budget : 1;
+	mod->window = jiffies;
+	mod->enable = 0x0fffff0f;
+
+	/* all sources on one vector until the probe sets up more */
+	dev->irq_vecs = 1;
+	dev->vec[0].dev = dev;
+	dev->vec[0].nr = 0;
+	dev->vec[0].mask = 0x0fffff0f;
+	dev->vec[0].cpu = -1;
+}
+
+static void ddb_irq_write_enable(struct ddb *dev)
+{
+	u32 i;
+
+	for (i = 0; i < dev->irq_vecs; i++)
+		ddbwritel(dev, dev->irq_mod.enable & dev->vec[i].mask,
+			  MSI_ENABLE(i));
+}
+
+static void ddb_port_probe_work(struct work_struct *work)
+{
+	struct ddb_port *port = container_of(work, struct ddb_port,
+					     probe_work);
+	ktime_t start = ktime_get();
+
+	ddb_port_probe(port);
+	port->probe_ms = ktime_us_delta(ktime_get(), start) / 1000;
+}
+
+/* Every port has its own I2C bus, so the ports are probed in parallel.
+   Everything depending on the result is done afterwards in port order,
+   so the numbering of inputs, outputs and adapters does not change. */
+
 static void ddb_ports_init(struct ddb *dev)
 {
 	int i;
 	struct ddb_port *port;
+	ktime_t start = ktime_get();
+	u32 reset_ms = 0;
 
 	if (dev->info->board_control) {
 		ddbwritel(dev, 0, BOARD_CONTROL);
@@ -2408,6 +3395,7 @@ static void ddb_ports_init(struct ddb *dev)
 		usleep_range(2000, 3000);
 		ddbwritel(dev, 4 | dev->info->board_control, BOARD_CONTROL);
 		usleep_range(2000, 3000);
+		reset_ms = ktime_us_delta(ktime_get(), start) / 1000;
 	}
 
 	for (i = 0; i < dev->info->port_num; i++) {
@@ -2418,9 +3406,18 @@ static void ddb_ports_init(struct ddb *dev)
 		port->gap = 4;
 		port->obr = ci_bitrate;
 		mutex_init(&port->i2c_gate_lock);
-		ddb_port_probe(port);
-		pr_info("Port %d (TAB %d): %s\n",
-			port->nr, port->nr + 1, port->name);
+		INIT_WORK(&port->probe_work, ddb_port_probe_work);
+		if (probe_async)
+			queue_work(system_unbound_wq, &port->probe_work);
+		else
+			ddb_port_probe_work(&port->probe_work);
+	}
+
+	for (i = 0; i < dev->info->port_num; i++) {
+		port = &dev->port[i];
+		flush_work(&port->probe_work);
+		pr_info("Port %d (TAB %d): %s (%u ms)\n",
+			port->nr, port->nr + 1, port->name, port->probe_ms);
 
 		port->dvb[0].adap = &dev->adap[2 * i];
 		port->dvb[1].adap = &dev->adap[2 * i + 1];
@@ -2444,6 +3441,8 @@ static void ddb_ports_init(struct ddb *dev)
 				(unsigned long) &dev->output[i];
 		}
 	}
+	dev_info(dev->dev, "ports probed in %u ms, board reset %u ms\n",
+		 (u32) (ktime_us_delta(ktime_get(), start) / 1000), reset_ms);
 }
 
 static void ddb_ports_release(struct ddb *dev)
@@ -2451,8 +3450,13 @@ static void ddb_ports_release(struct ddb *dev)
 	int i;
 	struct ddb_port *port;
 
+	del_timer_sync(&dev->irq_mod.timer);
 	if (!dev->has_dma)
 		return;
+	mutex_lock(&redirect_lock);
+	for (i = 0; i < DDB_MAX_INPUT; i++)
+		ddb_chain_set(&dev->input[i], 0);
+	mutex_unlock(&redirect_lock);
 	for (i = 0; i < dev->info->port_num; i++) {
 		port = &dev->port[i];
 #ifdef DDB_USE_WORK
@@ -2484,16 +3488,121 @@ static void ddb_ports_release(struct ddb *dev)
 
 static void irq_handle_msg(struct ddb *dev, u32 s)
 {
-	dev->i2c_irq++;
+	atomic_inc(&dev->i2c_irq);
 	IRQ_HANDLE(0);
 	IRQ_HANDLE(1);
 	IRQ_HANDLE(2);
 	IRQ_HANDLE(3);
 }
 
+/* Adaptive interrupt moderation:
+   An input raising more than irq_mod.high IRQs/s gets its IRQ masked and
+   is served by ddb_irq_poll() instead. Once it was idle for irq_mod.idle
+   polls its IRQ is enabled again. IRQs are counted per DMA channel, so a
+   busy input does not push the others into polling. */
+
+#define DDB_IRQ_MOD_MASK    0x0000ff00
+#define DDB_IRQ_MOD_WINDOW  (HZ / 10 ? HZ / 10 : 1)
+
+static void ddb_irq_mod_window(struct ddb *dev)
+{
+	struct ddb_irq_mod *mod = &dev->irq_mod;
+	unsigned long delta = jiffies - mod->window;
+	u32 i;
+
+	if (delta < DDB_IRQ_MOD_WINDOW)
+		return;
+	for (i = 8; i < 16; i++)
+		mod->rate[i] = mod->count[i] * HZ / delta;
+	mod->window = jiffies;
+	memset(mod->count, 0, sizeof(mod->count));
+}
+
+static void ddb_irq_mod_check(struct ddb *dev, u32 s)
+{
+	struct ddb_irq_mod *mod = &dev->irq_mod;
+	u32 i, mask = 0, limit;
+
+	spin_lock(&mod->lock);
+	ddb_irq_mod_window(dev);
+	limit = mod->high * DDB_IRQ_MOD_WINDOW / HZ;
+	s &= DDB_IRQ_MOD_MASK & mod->enable;
+	for (i = 8; i < 16; i++) {
+		if (!(s & (1 << i)) || !dev->handler[i])
+			continue;
+		if (++mod->count[i] <= limit || !mod->high)
+			continue;
+		mask |= (1 << i);
+		mod->idle_cnt[i] = 0;
+		mod->last_stat[i] = 0xffffffff;
+	}
+	if (mask) {
+		mod->enable &= ~mask;
+		mod->polling |= mask;
+		ddb_irq_write_enable(dev);
+		mod_timer(&mod->timer,
+			  jiffies + msecs_to_jiffies(mod->interval));
+	}
+	spin_unlock(&mod->lock);
+}
+
+static void ddb_irq_poll_handle(struct ddb *dev, u32 nr)
+{
+	unsigned long flags;
+
+	/* handlers expect to run with interrupts off */
+	local_irq_save(flags);
+	dev->handler[nr](dev->handler_data[nr]);
+	local_irq_restore(flags);
+}
+
+static void ddb_irq_poll(unsigned long data)
+{
+	struct ddb *dev = (struct ddb *) data;
+	struct ddb_irq_mod *mod = &dev->irq_mod;
+	u32 i, nr = 0, stat, budget = mod->budget;
+	unsigned long flags;
+
+	mod->polls++;
+	for (i = 0; i < 32 && budget; i++) {
+		nr = (mod->next + i) & 31;
+		if (!(mod->polling & (1 << nr)))
+			continue;
+		stat = ddbreadl(dev, DMA_BUFFER_CURRENT(nr - 8));
+		if (stat != mod->last_stat[nr]) {
+			mod->last_stat[nr] = stat;
+			mod->idle_cnt[nr] = 0;
+			ddb_irq_poll_handle(dev, nr);
+			budget--;
+			continue;
+		}
+		if (++mod->idle_cnt[nr] < mod->idle)
+			continue;
+		spin_lock_irqsave(&mod->lock, flags);
+		mod->polling &= ~(1 << nr);
+		mod->enable |= (1 << nr);
+		ddb_irq_write_enable(dev);
+		spin_unlock_irqrestore(&mod->lock, flags);
+		/* catch blocks completed while the IRQ was masked */
+		ddb_irq_poll_handle(dev, nr);
+	}
+	mod->next = (nr + 1) & 31;
+
+	spin_lock_irqsave(&mod->lock, flags);
+	ddb_irq_mod_window(dev);
+	if (mod->polling)
+		mod_timer(&mod->timer,
+			  jiffies + msecs_to_jiffies(mod->interval));
+	spin_unlock_irqrestore(&mod->lock, flags);
+}
+
 static void irq_handle_io(struct ddb *dev, u32 s)
 {
-	dev->ts_irq++;
+	atomic_inc(&dev->ts_irq);
+	if (dev->has_dma) {
+		ddb_irq_mod_check(dev, s);
+		s &= ~dev->irq_mod.polling;
+	}
 	IRQ_HANDLE(8);
 	IRQ_HANDLE(9);
 	IRQ_HANDLE(10);
@@ -2578,6 +3687,35 @@ static irqreturn_t irq_handler(int irq, void *dev_id)
 	return ret;
 }
 
+/* Handler for one of several MSI vectors, only serves the sources
+   routed to it in MSI<n>_ENABLE. */
+
+static irqreturn_t irq_handler_vec(int irq, void *dev_id)
+{
+	struct ddb_irq_vec *vec = (struct ddb_irq_vec *) dev_id;
+	struct ddb *dev = vec->dev;
+	u32 s = ddbreadl(dev, INTERRUPT_STATUS);
+
+	if (s & 0x80000000)
+		return IRQ_NONE;
+	s &= vec->mask;
+	if (!s)
+		return IRQ_NONE;
+	do {
+		ddbwritel(dev, s, INTERRUPT_ACK);
+		vec->irqs++;
+		if (s & 0x0000000f)
+			irq_handle_msg(dev, s);
+		if (s & 0x0fffff00)
+			irq_handle_io(dev, s);
+		s = ddbreadl(dev, INTERRUPT_STATUS);
+		if (s & 0x80000000)
+			break;
+	} while ((s &= vec->mask));
+
+	return IRQ_HANDLED;
+}
+
 #ifdef DDB_TEST_THREADED
 static irqreturn_t irq_thread(int irq, void *dev_id)
 {
@@ -2595,19 +3733,210 @@ static irqreturn_t irq_thread(int irq, void *dev_id)
 
 #ifdef DVB_NSD
 
+static void ddb_nsd_hw_start(struct ddb *dev, struct dvb_nsd_ts *ts)
+{
+	u32 ctrl = ((ts->input & 7) << 8) | ((ts->filter_mask & 3) << 2);
+	u32 to;
+
+	ddbwritel(dev, ctrl, TS_CAPTURE_CONTROL);
+	ddbwritel(dev, ts->pid, TS_CAPTURE_PID);
+	ddbwritel(dev, (ts->section_id << 16) |
+		  (ts->table << 8) | ts->section,
+		  TS_CAPTURE_TABLESECTION);
+	/* 1024 ms default timeout if timeout set to 0 */
+	if (ts->timeout)
+		to = ts->timeout;
+	else
+		to = 1024;
+	/* 21 packets default if num set to 0 */
+	if (ts->num)
+		to |= ((u32) ts->num << 16);
+	else
+		to |= (21 << 16);
+	ddbwritel(dev, to, TS_CAPTURE_TIMEOUT);
+	if (ts->mode)
+		ctrl |= 2;
+	ddbwritel(dev, ctrl | 1, TS_CAPTURE_CONTROL);
+}
+
+/* Queued captures, see NSD_QUEUE_GET_TS. The capture engine has no
+   interrupt, so while a capture runs the work checks
+   TS_CAPTURE_CONTROL every jiffy instead of the reader spinning on
+   NSD_POLL_GET_TS. All of this runs under nsd->lock. */
+
+static void ddb_nsd_finish(struct ddb *dev, s32 status)
+{
+	struct ddb_nsd *nsd = &dev->nsd;
+	struct ddb_nsd_req *req = nsd->cur;
+
+	if (!status) {
+		req->res.len = ddbreadl(dev, TS_CAPTURE_RECEIVED) & 0x1fff;
+		if (req->res.len > TS_CAPTURE_LEN)
+			req->res.len = TS_CAPTURE_LEN;
+		ddbcpyfrom(dev, req->buf, TS_CAPTURE_MEMORY, req->res.len);
+	}
+	req->res.status = status;
+	ddb_dvb_input_stop(&dev->input[req->ts.input & 7]);
+	list_add_tail(&req->list, &nsd->done);
+	nsd->cur = 0;
+	wake_up_interruptible(&nsd->wq);
+}
+
+static void ddb_nsd_next(struct ddb *dev)
+{
+	struct ddb_nsd *nsd = &dev->nsd;
+	struct ddb_nsd_req *req;
+
+	if (nsd->cur || list_empty(&nsd->queue))
+		return;
+	/* wait for a capture started by NSD_START_GET_TS */
+	if (!(ddbreadl(dev, TS_CAPTURE_CONTROL) & 1)) {
+		req = list_first_entry(&nsd->queue, struct ddb_nsd_req, list);
+		list_del(&req->list);
+		nsd->cur = req;
+		req->end = jiffies +
+			msecs_to_jiffies((req->ts.timeout ? : 1024) + 1000);
+		if (ddb_dvb_input_start(&dev->input[req->ts.input & 7]) < 0) {
+			/* like ddb_nsd_finish() without input to stop */
+			req->res.status = -ENOMEM;
+			list_add_tail(&req->list, &nsd->done);
+			nsd->cur = 0;
+			wake_up_interruptible(&nsd->wq);
+			ddb_nsd_next(dev);
+			return;
+		}
+		ddb_nsd_hw_start(dev, &req->ts);
+	}
+	schedule_delayed_work(&nsd->work, 1);
+}
+
+static void ddb_nsd_work(struct work_struct *work)
+{
+	struct ddb_nsd *nsd = container_of(work, struct ddb_nsd, work.work);
+	struct ddb *dev = container_of(nsd, struct ddb, nsd);
+	u32 ctrl;
+
+	mutex_lock(&nsd->lock);
+	if (nsd->cur) {
+		ctrl = ddbreadl(dev, TS_CAPTURE_CONTROL);
+		if (!(ctrl & 1)) {
+			ddb_nsd_finish(dev, (ctrl & (1 << 14)) ?
+				       -ETIMEDOUT : 0);
+		} else if (time_after(jiffies, nsd->cur->end)) {
+			ddbwritel(dev, 0, TS_CAPTURE_CONTROL);
+			ddb_nsd_finish(dev, -ETIMEDOUT);
+		} else
+			schedule_delayed_work(&nsd->work, 1);
+	}
+	ddb_nsd_next(dev);
+	mutex_unlock(&nsd->lock);
+}
+
+static void ddb_nsd_flush(struct ddb *dev)
+{
+	struct ddb_nsd *nsd = &dev->nsd;
+	struct ddb_nsd_req *req, *next;
+
+	cancel_delayed_work_sync(&nsd->work);
+	mutex_lock(&nsd->lock);
+	if (nsd->cur) {
+		ddbwritel(dev, 0, TS_CAPTURE_CONTROL);
+		ddb_nsd_finish(dev, -ECANCELED);
+	}
+	list_splice_tail_init(&nsd->queue, &nsd->done);
+	list_for_each_entry_safe(req, next, &nsd->done, list) {
+		list_del(&req->list);
+		kfree(req);
+	}
+	nsd->num = 0;
+	mutex_unlock(&nsd->lock);
+}
+
+static int ddb_nsd_queue(struct ddb *dev, struct dvb_nsd_ts *ts)
+{
+	struct ddb_nsd *nsd = &dev->nsd;
+	struct ddb_nsd_req *req;
+	int id;
+
+	req = kzalloc(sizeof(*req), GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+	req->ts = *ts;
+	req->res.input = ts->input;
+	req->res.pid = ts->pid;
+
+	mutex_lock(&nsd->lock);
+	if (nsd->num >= DDB_NSD_QUEUE) {
+		mutex_unlock(&nsd->lock);
+		kfree(req);
+		return -EBUSY;
+	}
+	nsd->num++;
+	nsd->id = (nsd->id + 1) & 0x7fffffff;
+	if (!nsd->id)
+		nsd->id = 1;
+	id = req->res.id = nsd->id;
+	list_add_tail(&req->list, &nsd->queue);
+	ddb_nsd_next(dev);
+	mutex_unlock(&nsd->lock);
+	return id;
+}
+
 static ssize_t nsd_read(struct file *file, char *buf,
 			size_t count, loff_t *ppos)
 {
-	return 0;
+	struct dvb_device *dvbdev = file->private_data;
+	struct ddb *dev = dvbdev->priv;
+	struct ddb_nsd *nsd = &dev->nsd;
+	struct ddb_nsd_req *req;
+	ssize_t ret;
+
+	mutex_lock(&nsd->lock);
+	while (list_empty(&nsd->done)) {
+		mutex_unlock(&nsd->lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EWOULDBLOCK;
+		ret = wait_event_interruptible(nsd->wq,
+					       !list_empty(&nsd->done));
+		if (ret < 0)
+			return ret;
+		mutex_lock(&nsd->lock);
+	}
+	req = list_first_entry(&nsd->done, struct ddb_nsd_req, list);
+	ret = sizeof(req->res) + req->res.len;
+	if (count < ret) {
+		mutex_unlock(&nsd->lock);
+		return -EINVAL;
+	}
+	list_del(&req->list);
+	nsd->num--;
+	mutex_unlock(&nsd->lock);
+
+	if (copy_to_user(buf, &req->res, sizeof(req->res)) ||
+	    copy_to_user(buf + sizeof(req->res), req->buf, req->res.len))
+		ret = -EFAULT;
+	kfree(req);
+	return ret;
 }
 
 static unsigned int nsd_poll(struct file *file, poll_table *wait)
 {
-	return 0;
+	struct dvb_device *dvbdev = file->private_data;
+	struct ddb *dev = dvbdev->priv;
+	unsigned int mask = 0;
+
+	poll_wait(file, &dev->nsd.wq, wait);
+	if (!list_empty(&dev->nsd.done))
+		mask |= POLLIN | POLLRDNORM;
+	return mask;
 }
 
 static int nsd_release(struct inode *inode, struct file *file)
 {
+	struct dvb_device *dvbdev = file->private_data;
+	struct ddb *dev = dvbdev->priv;
+
+	ddb_nsd_flush(dev);
 	return dvb_generic_release(inode, file);
 }
 
@@ -2628,37 +3957,27 @@ static int nsd_do_ioctl(struct file *file, unsigned int cmd, void *parg)
 	case NSD_START_GET_TS:
 	{
 		struct dvb_nsd_ts *ts = parg;
-		u32 ctrl = ((ts->input & 7) << 8) |
-			((ts->filter_mask & 3) << 2);
-		u32 to;
 
-		if (ddbreadl(dev, TS_CAPTURE_CONTROL) & 1) {
+		mutex_lock(&dev->nsd.lock);
+		if (dev->nsd.cur ||
+		    (ddbreadl(dev, TS_CAPTURE_CONTROL) & 1)) {
+			mutex_unlock(&dev->nsd.lock);
 			pr_info("ts capture busy\n");
 			return -EBUSY;
 		}
-		ddb_dvb_input_start(&dev->input[ts->input & 7]);
-
-		ddbwritel(dev, ctrl, TS_CAPTURE_CONTROL);
-		ddbwritel(dev, ts->pid, TS_CAPTURE_PID);
-		ddbwritel(dev, (ts->section_id << 16) |
-			  (ts->table << 8) | ts->section,
-			  TS_CAPTURE_TABLESECTION);
-		/* 1024 ms default timeout if timeout set to 0 */
-		if (ts->timeout)
-			to = ts->timeout;
-		else
-			to = 1024;
-		/* 21 packets default if num set to 0 */
-		if (ts->num)
-			to |= ((u32) ts->num << 16);
-		else
-			to |= (21 << 16);
-		ddbwritel(dev, to, TS_CAPTURE_TIMEOUT);
-		if (ts->mode)
-			ctrl |= 2;
-		ddbwritel(dev, ctrl | 1, TS_CAPTURE_CONTROL);
+		ret = ddb_dvb_input_start(&dev->input[ts->input & 7]);
+		if (ret < 0) {
+			mutex_unlock(&dev->nsd.lock);
+			return ret;
+		}
+		ret = 0;
+		ddb_nsd_hw_start(dev, ts);
+		mutex_unlock(&dev->nsd.lock);
 		break;
 	}
+	case NSD_QUEUE_GET_TS:
+		ret = ddb_nsd_queue(dev, parg);
+		break;
 	case NSD_POLL_GET_TS:
 	{
 		struct dvb_nsd_ts *ts = parg;
@@ -2681,9 +4000,16 @@ static int nsd_do_ioctl(struct file *file, unsigned int cmd, void *parg)
 	{
 		u32 ctrl = 0;
 		pr_info("cancel ts capture: 0x%x\n", ctrl);
+		mutex_lock(&dev->nsd.lock);
 		ddbwritel(dev, ctrl, TS_CAPTURE_CONTROL);
 		ctrl = ddbreadl(dev, TS_CAPTURE_CONTROL);
 		/*pr_info("control register is 0x%x\n", ctrl);*/
+		/* a queued capture is finished, the next one started */
+		if (dev->nsd.cur) {
+			ddb_nsd_finish(dev, -ECANCELED);
+			ddb_nsd_next(dev);
+		}
+		mutex_unlock(&dev->nsd.lock);
 		break;
 	}
 	case NSD_STOP_GET_TS:
@@ -2733,6 +4059,12 @@ static int ddb_nsd_attach(struct ddb *dev)
 {
 	int ret;
 
+	mutex_init(&dev->nsd.lock);
+	INIT_LIST_HEAD(&dev->nsd.queue);
+	INIT_LIST_HEAD(&dev->nsd.done);
+	INIT_DELAYED_WORK(&dev->nsd.work, ddb_nsd_work);
+	init_waitqueue_head(&dev->nsd.wq);
+
 	ret = dvb_register_device(&dev->adap[0],
 				  &dev->nsd_dev,
 				  &dvbdev_nsd, (void *) dev,
@@ -3107,7 +4439,7 @@ static ssize_t ts_irq_show(struct device *device,
 {
 	struct ddb *dev = dev_get_drvdata(device);
 
-	return sprintf(buf, "%d\n", dev->ts_irq);
+	return sprintf(buf, "%d\n", atomic_read(&dev->ts_irq));
 }
 
 static ssize_t i2c_irq_show(struct device *device,
@@ -3115,7 +4447,82 @@ static ssize_t i2c_irq_show(struct device *device,
 {
 	struct ddb *dev = dev_get_drvdata(device);
 
-	return sprintf(buf, "%d\n", dev->i2c_irq);
+	return sprintf(buf, "%d\n", atomic_read(&dev->i2c_irq));
+}
+
+static ssize_t irq_mod_show(struct device *device,
+			    struct device_attribute *attr, char *buf)
+{
+	struct ddb *dev = dev_get_drvdata(device);
+	struct ddb_irq_mod *mod = &dev->irq_mod;
+
+	return sprintf(buf, "%u %u %u %u\n",
+		       mod->high, mod->interval, mod->idle, mod->budget);
+}
+
+static ssize_t irq_mod_store(struct device *device,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct ddb *dev = dev_get_drvdata(device);
+	struct ddb_irq_mod *mod = &dev->irq_mod;
+	unsigned int high, interval, idle, budget;
+
+	if (!dev->has_dma)
+		return -EINVAL;
+	if (sscanf(buf, "%u %u %u %u\n",
+		   &high, &interval, &idle, &budget) != 4)
+		return -EINVAL;
+	if (!interval || !idle || !budget)
+		return -EINVAL;
+	spin_lock_irq(&mod->lock);
+	mod->high = high;
+	mod->interval = interval;
+	mod->idle = idle;
+	mod->budget = budget;
+	spin_unlock_irq(&mod->lock);
+	return count;
+}
+
+static ssize_t irq_rate_show(struct device *device,
+			     struct device_attribute *attr, char *buf)
+{
+	struct ddb *dev = dev_get_drvdata(device);
+	struct ddb_irq_mod *mod = &dev->irq_mod;
+	int i, len;
+
+	len = sprintf(buf, "%u %08x", mod->polls, mod->polling);
+	for (i = 8; i < 16; i++)
+		len += sprintf(buf + len, " %u", mod->rate[i]);
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+
+static ssize_t irq_vec_show(struct device *device,
+			    struct device_attribute *attr, char *buf)
+{
+	struct ddb *dev = dev_get_drvdata(device);
+	struct ddb_irq_vec *vec;
+	int i, len = 0;
+
+	for (i = 0; i < dev->irq_vecs; i++) {
+		vec = &dev->vec[i];
+		len += sprintf(buf + len, "%u %08x %d %u\n",
+			       vec->nr, vec->mask, vec->cpu, vec->irqs);
+	}
+	return len;
+}
+
+static ssize_t numa_show(struct device *device,
+			 struct device_attribute *attr, char *buf)
+{
+	struct ddb *dev = dev_get_drvdata(device);
+	const struct cpumask *cpus = ddb_node_cpus(dev);
+	char list[64] = "-";
+
+	if (cpus)
+		cpulist_scnprintf(list, sizeof(list), cpus);
+	return sprintf(buf, "%d %s\n", dev->node, list);
 }
 
 static char *class_name[] = {
@@ -3343,25 +4750,265 @@ static ssize_t bsnr_show(struct device *device,
 static ssize_t redirect_show(struct device *device,
 			     struct device_attribute *attr, char *buf)
 {
-	return 0;
+	struct ddb *dev = dev_get_drvdata(device);
+	struct ddb_input *input;
+	struct ddb_output *o;
+	int i, j, len = 0;
+
+	mutex_lock(&redirect_lock);
+	for (i = 0; i < DDB_MAX_INPUT; i++) {
+		input = &dev->input[i];
+		if (!input->port || !input->redo)
+			continue;
+		len += sprintf(buf + len, "%02x", (dev->nr << 4) | i);
+		for (j = 0; j <= input->fan_num; j++) {
+			o = j ? input->fan[j - 1] : input->redo;
+			len += sprintf(buf + len, " %02x",
+				       (o->port->dev->nr << 4) | o->port->nr);
+		}
+		len += sprintf(buf + len, "\n");
+	}
+	mutex_unlock(&redirect_lock);
+	return len;
 }
 
 static ssize_t redirect_store(struct device *device,
 			      struct device_attribute *attr,
 			      const char *buf, size_t count)
 {
-	unsigned int i, p;
+	unsigned int i, p[DDB_MAX_FAN + 1];
+	int n, j, res;
+
+	n = sscanf(buf, "%x %x %x %x %x\n", &i, &p[0], &p[1], &p[2], &p[3]);
+	if (n < 2)
+		return -EINVAL;
+	res = ddb_redirect(i, p[0]);
+	for (j = 1; res >= 0 && j < n - 1; j++)
+		res = ddb_redirect_fan(i, p[j]);
+	if (res < 0)
+		return res;
+	pr_info("redirect: %02x, %02x\n", i, p[0]);
+	for (j = 1; j < n - 1; j++)
+		pr_info("redirect: %02x, %02x (fan-out)\n", i, p[j]);
+	return count;
+}
+
+static ssize_t dma_show(struct device *device,
+			struct device_attribute *attr, char *buf)
+{
+	struct ddb *dev = dev_get_drvdata(device);
+	struct ddb_dma *dma;
+	int i, len = 0;
+
+	for (i = 0; i < DDB_MAX_INPUT; i++) {
+		dma = dev->input[i].dma;
+		if (!dma || !dev->input[i].port)
+			continue;
+		len += sprintf(buf + len, "I%d %u %u %u\n",
+			       i, dma->num, dma->size, dma->div);
+	}
+	for (i = 0; i < DDB_MAX_OUTPUT; i++) {
+		dma = dev->output[i].dma;
+		if (!dma || !dev->output[i].port)
+			continue;
+		len += sprintf(buf + len, "O%d %u %u %u\n",
+			       i, dma->num, dma->size, dma->div);
+	}
+	return len;
+}
+
+static ssize_t dma_store(struct device *device, struct device_attribute *attr,
+			 const char *buf, size_t count)
+{
+	struct ddb *dev = dev_get_drvdata(device);
+	struct ddb_io *io;
+	unsigned int nr, num, size, div;
+	char type;
 	int res;
 
-	if (sscanf(buf, "%x %x\n", &i, &p) != 2)
+	if (!dev->has_dma)
+		return -EINVAL;
+	if (sscanf(buf, "%c%u %u %u %u\n", &type, &nr, &num, &size, &div) != 5)
+		return -EINVAL;
+	if (type == 'I' && nr < DDB_MAX_INPUT)
+		io = &dev->input[nr];
+	else if (type == 'O' && nr < DDB_MAX_OUTPUT)
+		io = &dev->output[nr];
+	else
+		return -EINVAL;
+	if (!io->dma || !io->port)
 		return -EINVAL;
-	res = ddb_redirect(i, p);
+
+	mutex_lock(&redirect_lock);
+	if ((type == 'I' && io->redo) || (type == 'O' && io->redi))
+		res = -EBUSY;
+	else
+		res = ddb_dma_reconfig(dev, io->dma, type == 'O',
+				       num, size, div);
+	mutex_unlock(&redirect_lock);
 	if (res < 0)
 		return res;
-	pr_info("redirect: %02x, %02x\n", i, p);
 	return count;
 }
 
+static void ddb_dma_stat_sum(struct ddb_dma *dma, struct ddb_dma_stat *sum)
+{
+	struct ddb_dma_stat *ps;
+	int cpu, i;
+
+	memset(sum, 0, sizeof(*sum));
+	if (!dma->pstat)
+		return;
+	for_each_possible_cpu(cpu) {
+		ps = per_cpu_ptr(dma->pstat, cpu);
+		sum->bytes += ps->bytes;
+		sum->blocks += ps->blocks;
+		sum->overflows += ps->overflows;
+		sum->irqs += ps->irqs;
+		for (i = 0; i < DDB_LAT_BINS; i++) {
+			sum->irq_lat[i] += ps->irq_lat[i];
+			sum->work_lat[i] += ps->work_lat[i];
+		}
+	}
+}
+
+static ssize_t i2c_stat_show(struct device *device,
+			     struct device_attribute *attr, char *buf)
+{
+	struct ddb *dev = dev_get_drvdata(device);
+	struct ddb_i2c_stat *st;
+	int i, len = 0;
+
+	for (i = 0; i < dev->info->i2c_num; i++) {
+		st = &dev->i2c[i].stat;
+		len += sprintf(buf + len, "%d %u %llu %u %u\n", i,
+			       st->tasks, st->bytes, st->timeouts, st->naks);
+	}
+	return len;
+}
+
+static ssize_t i2c_lat_show(struct device *device,
+			    struct device_attribute *attr, char *buf)
+{
+	struct ddb *dev = dev_get_drvdata(device);
+	struct ddb_i2c_stat *st;
+	int i, j, len = 0;
+
+	for (i = 0; i < dev->info->i2c_num; i++) {
+		st = &dev->i2c[i].stat;
+		len += sprintf(buf + len, "%d", i);
+		for (j = 0; j < DDB_LAT_BINS; j++)
+			len += sprintf(buf + len, " %u", st->lat[j]);
+		for (j = 0; j < DDB_LAT_BINS; j++)
+			len += sprintf(buf + len, " %u",
+				       atomic_read(&st->gate_lat[j]));
+		len += sprintf(buf + len, "\n");
+	}
+	return len;
+}
+
+static ssize_t dma_stat_show(struct device *device,
+			     struct device_attribute *attr, char *buf)
+{
+	struct ddb *dev = dev_get_drvdata(device);
+	struct ddb_dma_stat sum;
+	struct ddb_dma *dma;
+	int i, len = 0;
+
+	for (i = 0; i < DDB_MAX_INPUT; i++) {
+		dma = dev->input[i].dma;
+		if (!dma || !dev->input[i].port)
+			continue;
+		ddb_dma_stat_sum(dma, &sum);
+		len += sprintf(buf + len, "I%d %llu %u %u %u\n", i,
+			       (unsigned long long) sum.bytes, sum.blocks,
+			       sum.overflows, sum.irqs);
+	}
+	for (i = 0; i < DDB_MAX_OUTPUT; i++) {
+		dma = dev->output[i].dma;
+		if (!dma || !dev->output[i].port)
+			continue;
+		ddb_dma_stat_sum(dma, &sum);
+		len += sprintf(buf + len, "O%d %llu %u %u %u\n", i,
+			       (unsigned long long) sum.bytes, sum.blocks,
+			       sum.overflows, sum.irqs);
+	}
+	return len;
+}
+
+static ssize_t dma_lat_show(struct device *device,
+			    struct device_attribute *attr, char *buf)
+{
+	struct ddb *dev = dev_get_drvdata(device);
+	struct ddb_dma_stat sum;
+	struct ddb_io *io;
+	int i, j, len = 0;
+
+	for (i = 0; i < DDB_MAX_INPUT; i++) {
+		io = &dev->input[i];
+		if (!io->dma || !io->port)
+			continue;
+		ddb_dma_stat_sum(io->dma, &sum);
+		len += sprintf(buf + len, "I%d", i);
+		for (j = 0; j < DDB_LAT_BINS; j++)
+			len += sprintf(buf + len, " %u", sum.irq_lat[j]);
+		for (j = 0; j < DDB_LAT_BINS; j++)
+			len += sprintf(buf + len, " %u", sum.work_lat[j]);
+		len += sprintf(buf + len, "\n");
+	}
+	return len;
+}
+
+#ifdef DDB_USE_WORK
+static ssize_t demux_cpus_show(struct device *device,
+			       struct device_attribute *attr, char *buf)
+{
+	struct ddb *dev = dev_get_drvdata(device);
+	struct ddb_dma *dma;
+	char list[64];
+	int i, len = 0;
+
+	for (i = 0; i < DDB_MAX_INPUT; i++) {
+		dma = dev->input[i].dma;
+		if (!dma || !dev->input[i].port)
+			continue;
+		cpulist_scnprintf(list, sizeof(list), &dma->cpus);
+		len += sprintf(buf + len, "I%d %d %s\n", i, dma->cpu, list);
+	}
+	return len;
+}
+
+static ssize_t demux_cpus_store(struct device *device,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct ddb *dev = dev_get_drvdata(device);
+	struct ddb_dma *dma;
+	cpumask_t mask;
+	unsigned int nr;
+	char list[64];
+	int n;
+
+	if (!dev->has_dma)
+		return -EINVAL;
+	n = sscanf(buf, "I%u %63s\n", &nr, list);
+	if (n < 1 || nr >= DDB_MAX_INPUT)
+		return -EINVAL;
+	dma = dev->input[nr].dma;
+	if (!dma || !dev->input[nr].port)
+		return -EINVAL;
+	cpumask_clear(&mask);
+	if (n == 2) {
+		if (cpulist_parse(list, &mask))
+			return -EINVAL;
+		if (!cpumask_intersects(&mask, cpu_online_mask))
+			return -EINVAL;
+	}
+	ddb_dma_set_cpus(dma, &mask);
+	return count;
+}
+#endif
+
 static ssize_t gap_show(struct device *device,
 			struct device_attribute *attr, char *buf)
 {
@@ -3416,6 +5063,10 @@ static struct device_attribute ddb_attrs[] = {
 	__ATTR_RO(ports),
 	__ATTR_RO(ts_irq),
 	__ATTR_RO(i2c_irq),
+	__ATTR(irq_mod, 0666, irq_mod_show, irq_mod_store),
+	__ATTR_RO(irq_rate),
+	__ATTR_RO(irq_vec),
+	__ATTR_RO(numa),
 	__ATTR(gap0, 0666, gap_show, gap_store),
 	__ATTR(gap1, 0666, gap_show, gap_store),
 	__ATTR(gap2, 0666, gap_show, gap_store),
@@ -3426,6 +5077,14 @@ static struct device_attribute ddb_attrs[] = {
 	__ATTR_RO(qam),
 #endif
 	__ATTR(redirect, 0666, redirect_show, redirect_store),
+	__ATTR(dma, 0644, dma_show, dma_store),
+	__ATTR_RO(dma_stat),
+	__ATTR_RO(dma_lat),
+	__ATTR_RO(i2c_stat),
+	__ATTR_RO(i2c_lat),
+#ifdef DDB_USE_WORK
+	__ATTR(demux_cpus, 0666, demux_cpus_show, demux_cpus_store),
+#endif
 	__ATTR_MRO(snr,  bsnr_show),
 	__ATTR_NULL,
 };
@@ -103,6 +103,7 @@ static int ddb_i2c_cmd(struct ddb_i2c *i2c, u32 adr, u32 cmd)
 	ddbwritel(dev, (adr << 9) | cmd, i2c->regs + I2C_COMMAND);
 	stat = wait_for_completion_timeout(&i2c->completion, HZ);
 	if (stat <= 0) {
+		i2c->stat.timeouts++;
 		pr_err("DDBridge I2C timeout, card %d, port %d\n",
 		       dev->nr, i2c->nr);
 #ifdef CONFIG_PCI_MSI
@@ -115,50 +116,121 @@ static int ddb_i2c_cmd(struct ddb_i2c *i2c, u32 adr, u32 cmd)
 		return -EIO;
 	}
 	val = ddbreadl(dev, i2c->regs + I2C_COMMAND);
-	if (val & 0x70000)
+	if (val & 0x70000) {
+		i2c->stat.naks++;
 		return -EIO;
+	}
+	return 0;
+}
+
+/* Each bus has I2C_TASKMEM_SIZE / 8 bytes of task memory for writing
+   and as much for reading. */
+
+#define DDB_I2C_BUF_SIZE (I2C_TASKMEM_SIZE / 8)
+
+/* Run one write, write+read or read task. The write data is expected at
+   offset woff of the task memory of the bus. */
+
+static int ddb_i2c_task(struct ddb_i2c *i2c, struct i2c_msg *w,
+			struct i2c_msg *r, u32 woff)
+{
+	struct ddb *dev = i2c->dev;
+	u32 len = 0, cmd = 3;
+	ktime_t t = ktime_get();
+	int ret;
+
+	if (w) {
+		len = w->len;
+		cmd = r ? 1 : 2;
+	}
+	if (r)
+		len |= r->len << 16;
+	ddbwritel(dev, (i2c->rbuf << 16) | woff,
+		  i2c->regs + I2C_TASKADDRESS);
+	ddbwritel(dev, len, i2c->regs + I2C_TASKLENGTH);
+	ret = ddb_i2c_cmd(i2c, w ? w->addr : r->addr, cmd);
+	t = ktime_sub(ktime_get(), t);
+	i2c->stat.tasks++;
+	i2c->stat.bytes += (len & 0xffff) + (len >> 16);
+	i2c->stat.lat[ddb_lat_bin(t)]++;
+	trace_ddb_i2c_task(dev->nr, i2c->nr, w ? w->addr : r->addr,
+			   w ? w->len : 0, r ? r->len : 0, ret,
+			   ktime_to_us(t));
+	if (ret)
+		return -EIO;
+	if (r)
+		ddbcpyfrom(dev, r->buf, I2C_TASKMEM_BASE + i2c->rbuf, r->len);
 	return 0;
 }
 
+/* The bridge cannot change the address or the direction without a STOP,
+   except for the repeated start of a write+read task. */
+
+#define DDB_I2C_UNSUPP (I2C_M_TEN | I2C_M_NOSTART | I2C_M_REV_DIR_ADDR | \
+			I2C_M_IGNORE_NAK | I2C_M_NO_RD_ACK | I2C_M_RECV_LEN)
+
+/* A queue of messages is executed as one task per write, write+read
+   (to the same address) or read message. Only the write+read task
+   uses a repeated start, all other tasks are separated by a STOP.
+   If all write data fits into the task memory it is copied there in
+   one go before the first task, so the tasks run back to back.
+   Otherwise every task gets its data copied right before it is started.
+   If a task fails after others went through, the number of completed
+   messages is returned so that the caller can resume from there. */
+
 static int ddb_i2c_master_xfer(struct i2c_adapter *adapter,
 			       struct i2c_msg msg[], int num)
 {
 	struct ddb_i2c *i2c = (struct ddb_i2c *) i2c_get_adapdata(adapter);
 	struct ddb *dev = i2c->dev;
-	u8 addr = 0;
-
-	if (num)
-		addr = msg[0].addr;
-	if (num == 2 && msg[1].flags & I2C_M_RD &&
-	    !(msg[0].flags & I2C_M_RD)) {
-		memcpy_toio(dev->regs + I2C_TASKMEM_BASE + i2c->wbuf,
-			    msg[0].buf, msg[0].len);
-		ddbwritel(dev, msg[0].len|(msg[1].len << 16),
-			  i2c->regs + I2C_TASKLENGTH);
-		if (!ddb_i2c_cmd(i2c, addr, 1)) {
-			memcpy_fromio(msg[1].buf,
-				      dev->regs + I2C_TASKMEM_BASE +
-				      i2c->rbuf,
-				      msg[1].len);
-			return num;
-		}
-	}
-	if (num == 1 && !(msg[0].flags & I2C_M_RD)) {
-		ddbcpyto(dev, I2C_TASKMEM_BASE + i2c->wbuf,
-			 msg[0].buf, msg[0].len);
-		ddbwritel(dev, msg[0].len, i2c->regs + I2C_TASKLENGTH);
-		if (!ddb_i2c_cmd(i2c, addr, 2))
-			return num;
+	struct i2c_msg *w, *r;
+	u32 woff = 0, total = 0;
+	int i, packed, ret = num;
+
+	for (i = 0; i < num; i++) {
+		if (msg[i].flags & DDB_I2C_UNSUPP)
+			return -EOPNOTSUPP;
+		if (msg[i].len > DDB_I2C_BUF_SIZE)
+			return -EINVAL;
+		if (!(msg[i].flags & I2C_M_RD))
+			total += ALIGN(msg[i].len, 4);
 	}
-	if (num == 1 && (msg[0].flags & I2C_M_RD)) {
-		ddbwritel(dev, msg[0].len << 16, i2c->regs + I2C_TASKLENGTH);
-		if (!ddb_i2c_cmd(i2c, addr, 3)) {
-			ddbcpyfrom(dev, msg[0].buf,
-				   I2C_TASKMEM_BASE + i2c->rbuf, msg[0].len);
-			return num;
+	packed = (num > 1 && total <= DDB_I2C_BUF_SIZE);
+	if (packed)
+		for (i = 0; i < num; i++) {
+			if (msg[i].flags & I2C_M_RD)
+				continue;
+			ddbcpyto(dev, I2C_TASKMEM_BASE + i2c->wbuf + woff,
+				 msg[i].buf, msg[i].len);
+			woff += ALIGN(msg[i].len, 4);
 		}
+
+	for (i = 0, woff = 0; i < num; i++) {
+		w = r = 0;
+		if (msg[i].flags & I2C_M_RD) {
+			r = &msg[i];
+		} else {
+			w = &msg[i];
+			if (i + 1 < num && (msg[i + 1].flags & I2C_M_RD) &&
+			    msg[i + 1].addr == w->addr)
+				r = &msg[i + 1];
+			if (!packed)
+				ddbcpyto(dev, I2C_TASKMEM_BASE + i2c->wbuf,
+					 w->buf, w->len);
+		}
+		if (ddb_i2c_task(i2c, w, r, i2c->wbuf + woff)) {
+			ret = i ? i : -EIO;
+			break;
+		}
+		if (w && r)
+			i++;
+		if (w && packed)
+			woff += ALIGN(w->len, 4);
 	}
-	return -EIO;
+	if (packed)
+		ddbwritel(dev, (i2c->rbuf << 16) | i2c->wbuf,
+			  i2c->regs + I2C_TASKADDRESS);
+	return ret;
 }
 
 #if 0
@@ -426,7 +426,7 @@ static int ns_start(struct dvbnss *nss)
 	struct ddb_input *input = ns->priv;
 	struct ddb *dev = input->port->dev;
 	u32 reg = 0x8003;
-
+	int ret;
 
 	if (nss->params.flags & DVB_NS_RTCP)
 		reg |= 0x10;
@@ -436,9 +436,17 @@ static int ns_start(struct dvbnss *nss)
 		reg |= 0x40;
 	if (nss->params.flags & DVB_NS_IPV6)
 		reg |= 0x80;
-	if (dns->fe != input->nr)
-		ddb_dvb_input_start(&dev->input[dns->fe]);
-	ddb_dvb_input_start(input);
+	if (dns->fe != input->nr) {
+		ret = ddb_dvb_input_start(&dev->input[dns->fe]);
+		if (ret < 0)
+			return ret;
+	}
+	ret = ddb_dvb_input_start(input);
+	if (ret < 0) {
+		if (dns->fe != input->nr)
+			ddb_dvb_input_stop(&dev->input[dns->fe]);
+		return ret;
+	}
 	ddbwritel(dev, reg | (dns->fe << 8), STREAM_CONTROL(dns->nr));
 	return 0;
 }
@@ -73,6 +73,7 @@
 #define MSI5_ENABLE      (INTERRUPT_BASE + 0x14)
 #define MSI6_ENABLE      (INTERRUPT_BASE + 0x18)
 #define MSI7_ENABLE      (INTERRUPT_BASE + 0x1C)
+#define MSI_ENABLE(i)    (INTERRUPT_BASE + (i) * 4)
 
 #define INTERRUPT_STATUS (INTERRUPT_BASE + 0x20)
 #define INTERRUPT_ACK    (INTERRUPT_BASE + 0x20)
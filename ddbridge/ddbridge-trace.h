@@ -0,0 +1,70 @@
+/*
+ * ddbridge-trace.h: Digital Devices bridge trace events
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 only, as published by the Free Software Foundation.
+ *
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ * Or, point your browser to http://www.gnu.org/copyleft/gpl.html
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ddbridge
+
+#if !defined(_DDBRIDGE_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _DDBRIDGE_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+/* One I2C task: write, write+read or read of one device address */
+
+TRACE_EVENT(ddb_i2c_task,
+	TP_PROTO(u32 card, u32 bus, u16 addr, u16 wlen, u16 rlen,
+		 int ret, s64 us),
+
+	TP_ARGS(card, bus, addr, wlen, rlen, ret, us),
+
+	TP_STRUCT__entry(
+		__field(u32, card)
+		__field(u32, bus)
+		__field(u16, addr)
+		__field(u16, wlen)
+		__field(u16, rlen)
+		__field(int, ret)
+		__field(s64, us)
+	),
+
+	TP_fast_assign(
+		__entry->card = card;
+		__entry->bus = bus;
+		__entry->addr = addr;
+		__entry->wlen = wlen;
+		__entry->rlen = rlen;
+		__entry->ret = ret;
+		__entry->us = us;
+	),
+
+	TP_printk("card=%u bus=%u addr=0x%02x wlen=%u rlen=%u ret=%d us=%lld",
+		  __entry->card, __entry->bus, __entry->addr, __entry->wlen,
+		  __entry->rlen, __entry->ret, __entry->us)
+);
+
+#endif /* _DDBRIDGE_TRACE_H_ */
+
+/* relative to include/ of this tree, which is on the include path */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH ../ddbridge
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ddbridge-trace
+#include <trace/define_trace.h>
@@ -41,6 +41,11 @@ static int msi = 1;
 module_param(msi, int, 0444);
 MODULE_PARM_DESC(msi,
 		 " Control MSI interrupts: 0-disable, 1-enable (default)");
+
+static int msi_vectors = DDB_MAX_MSI;
+module_param(msi_vectors, int, 0444);
+MODULE_PARM_DESC(msi_vectors,
+		 " Max. number of MSI vectors, more than 2 spreads the DMA channels over own vectors (default 8)");
 #endif
 
 #include "ddbridge-core.c"
@@ -57,6 +62,95 @@ static void ddb_unmap(struct ddb *dev)
 }
 
 
+static void ddb_irq_free(struct ddb *dev)
+{
+	u32 i;
+
+	for (i = 0; i < dev->irq_vecs; i++)
+		ddbwritel(dev, 0, MSI_ENABLE(i));
+#ifdef CONFIG_PCI_MSI
+	if (dev->msi > 2) {
+		for (i = 0; i < dev->irq_vecs; i++) {
+			irq_set_affinity_hint(dev->pdev->irq + i, NULL);
+			free_irq(dev->pdev->irq + i, &dev->vec[i]);
+		}
+		return;
+	}
+#endif
+	if (dev->msi == 2) {
+		irq_set_affinity_hint(dev->pdev->irq + 1, NULL);
+		free_irq(dev->pdev->irq + 1, dev);
+	}
+	irq_set_affinity_hint(dev->pdev->irq, NULL);
+	free_irq(dev->pdev->irq, dev);
+}
+
+#ifdef CONFIG_PCI_MSI
+/* Vector 0 keeps I2C and everything else, the DMA channels are spread
+   round robin over the remaining vectors, which get their affinity hint
+   on consecutive online CPUs of the card's NUMA node. */
+
+static int ddb_irq_vec_request(struct ddb *dev)
+{
+	const struct cpumask *cpus = ddb_node_cpus(dev);
+	struct ddb_irq_vec *vec;
+	int i, stat, nvec = msi_vectors, cpu = -1;
+
+	if (!cpus)
+		cpus = cpu_online_mask;
+
+	if (nvec > DDB_MAX_MSI)
+		nvec = DDB_MAX_MSI;
+	while (nvec > 2) {
+		stat = pci_enable_msi_block(dev->pdev, nvec);
+		if (stat == 0)
+			break;
+		if (stat < 0)
+			return stat;
+		nvec = stat;
+	}
+	if (nvec <= 2)
+		return -ENODEV;
+
+	for (i = 0; i < nvec; i++) {
+		vec = &dev->vec[i];
+		vec->dev = dev;
+		vec->nr = i;
+		vec->mask = i ? 0 : 0x0000000f;
+		vec->cpu = -1;
+		vec->irqs = 0;
+	}
+	for (i = 8; i < 28; i++)
+		dev->vec[1 + (i - 8) % (nvec - 1)].mask |= (1 << i);
+
+	for (i = 0; i < nvec; i++) {
+		vec = &dev->vec[i];
+		stat = request_irq(dev->pdev->irq + i, irq_handler_vec,
+				   0, "ddbridge", (void *) vec);
+		if (stat < 0)
+			goto fail;
+		cpu = cpumask_next_and(cpu, cpus, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first_and(cpus, cpu_online_mask);
+		vec->cpu = cpu;
+		irq_set_affinity_hint(dev->pdev->irq + i, cpumask_of(cpu));
+	}
+	dev->irq_vecs = nvec;
+	dev->msi = nvec;
+	pr_info("DDBridge using %d MSI interrupts\n", nvec);
+	return 0;
+
+fail:
+	while (--i >= 0) {
+		irq_set_affinity_hint(dev->pdev->irq + i, NULL);
+		free_irq(dev->pdev->irq + i, &dev->vec[i]);
+	}
+	pci_disable_msi(dev->pdev);
+	dev->vec[0].mask = 0x0fffff0f;
+	return stat;
+}
+#endif
+
 static void __devexit ddb_remove(struct pci_dev *pdev)
 {
 	struct ddb *dev = (struct ddb *) pci_get_drvdata(pdev);
@@ -64,11 +158,9 @@ static void __devexit ddb_remove(struct pci_dev *pdev)
 	ddb_ports_detach(dev);
 	ddb_i2c_release(dev);
 
-	ddbwritel(dev, 0, INTERRUPT_ENABLE);
-	ddbwritel(dev, 0, MSI1_ENABLE);
-	if (dev->msi == 2)
-		free_irq(dev->pdev->irq + 1, dev);
-	free_irq(dev->pdev->irq, dev);
+	dev->irq_mod.high = 0;
+	del_timer_sync(&dev->irq_mod.timer);
+	ddb_irq_free(dev);
 #ifdef CONFIG_PCI_MSI
 	if (dev->msi)
 		pci_disable_msi(dev->pdev);
@@ -97,11 +189,12 @@ static int __devinit ddb_probe(struct pci_dev *pdev,
 	if (pci_enable_device(pdev) < 0)
 		return -ENODEV;
 
-	dev = vzalloc(sizeof(struct ddb));
+	dev = vzalloc_node(sizeof(struct ddb), dev_to_node(&pdev->dev));
 	if (dev == NULL)
 		return -ENOMEM;
 
 	dev->has_dma = 1;
+	dev->node = dev_to_node(&pdev->dev);
 	dev->pdev = pdev;
 	dev->dev = &pdev->dev;
 	pci_set_drvdata(pdev, dev);
@@ -142,9 +235,12 @@ static int __devinit ddb_probe(struct pci_dev *pdev,
 	ddbwritel(dev, 0x00000000, MSI5_ENABLE);
 	ddbwritel(dev, 0x00000000, MSI6_ENABLE);
 	ddbwritel(dev, 0x00000000, MSI7_ENABLE);
+	ddb_irq_mod_init(dev);
 
 #ifdef CONFIG_PCI_MSI
-	if (msi && pci_msi_enabled()) {
+	if (msi && pci_msi_enabled() && msi_vectors > 2)
+		ddb_irq_vec_request(dev);
+	if (msi && pci_msi_enabled() && !dev->msi) {
 		stat = pci_enable_msi_block(dev->pdev, 2);
 		if (stat == 0) {
 			dev->msi = 1;
@@ -160,6 +256,12 @@ static int __devinit ddb_probe(struct pci_dev *pdev,
 		}
 	}
 	if (dev->msi == 2) {
+		dev->irq_vecs = 2;
+		dev->vec[0].mask = 0x0fffff00;
+		dev->vec[1].dev = dev;
+		dev->vec[1].nr = 1;
+		dev->vec[1].mask = 0x0000000f;
+		dev->vec[1].cpu = -1;
 		stat = request_irq(dev->pdev->irq, irq_handler0,
 				   irq_flag, "ddbridge", (void *) dev);
 		if (stat < 0)
@@ -170,7 +272,9 @@ static int __devinit ddb_probe(struct pci_dev *pdev,
 			free_irq(dev->pdev->irq, dev);
 			goto fail0;
 		}
-	} else
+		irq_set_affinity_hint(dev->pdev->irq, ddb_node_cpus(dev));
+		irq_set_affinity_hint(dev->pdev->irq + 1, ddb_node_cpus(dev));
+	} else if (dev->msi < 2)
 #endif
 	{
 #ifdef DDB_TEST_THREADED
@@ -184,19 +288,14 @@ static int __devinit ddb_probe(struct pci_dev *pdev,
 #endif
 		if (stat < 0)
 			goto fail0;
+		irq_set_affinity_hint(dev->pdev->irq, ddb_node_cpus(dev));
 	}
 	ddbwritel(dev, 0, DMA_BASE_READ);
 	if (dev->info->type != DDB_MOD)
 		ddbwritel(dev, 0, DMA_BASE_WRITE);
 
 	/*ddbwritel(dev, 0xffffffff, INTERRUPT_ACK);*/
-	if (dev->msi == 2) {
-		ddbwritel(dev, 0x0fffff00, INTERRUPT_ENABLE);
-		ddbwritel(dev, 0x0000000f, MSI1_ENABLE);
-	} else {
-		ddbwritel(dev, 0x0fffff0f, INTERRUPT_ENABLE);
-		ddbwritel(dev, 0x00000000, MSI1_ENABLE);
-	}
+	ddb_irq_write_enable(dev);
 	if (ddb_i2c_init(dev) < 0)
 		goto fail1;
 	ddb_ports_init(dev);
@@ -229,11 +328,7 @@ fail2:
 	ddb_i2c_release(dev);
 fail1:
 	pr_err("fail1\n");
-	ddbwritel(dev, 0, INTERRUPT_ENABLE);
-	ddbwritel(dev, 0, MSI1_ENABLE);
-	free_irq(dev->pdev->irq, dev);
-	if (dev->msi == 2)
-		free_irq(dev->pdev->irq + 1, dev);
+	ddb_irq_free(dev);
 fail0:
 	pr_err("fail0\n");
 	if (dev->msi)
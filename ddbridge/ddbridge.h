@@ -46,6 +46,7 @@
 #include <linux/i2c.h>
 #include <linux/swab.h>
 #include <linux/vmalloc.h>
+#include <linux/mm.h>
 #include <linux/workqueue.h>
 #include <linux/kthread.h>
 #include <linux/platform_device.h>
@@ -59,12 +60,14 @@
 #include <linux/interrupt.h>
 #include <linux/i2c.h>
 #include <linux/mutex.h>
+#include <linux/rcupdate.h>
 #include <asm/dma.h>
 #include <asm/irq.h>
 #include <linux/io.h>
 #include <linux/uaccess.h>
 
 #include <linux/dvb/ca.h>
+#include <linux/dvb/ci.h>
 #include <linux/socket.h>
 #include <linux/device.h>
 #include <linux/io.h>
@@ -153,6 +156,7 @@ struct ddb_info {
    MUST be divisible by 188 and 128 !!! */
 
 #define DMA_MAX_BUFS 32      /* hardware table limit */
+#define DMA_MAX_NUM  31      /* 5 bit block count in DMA_BUFFER_SIZE */
 
 #define INPUT_DMA_BUFS 8
 #define INPUT_DMA_SIZE (128*47*21)
@@ -165,6 +169,34 @@ struct ddb_info {
 struct ddb;
 struct ddb_port;
 
+/* per CPU statistics of a DMA channel,
+   latency bin i counts times below 16us * 4^i, the last one the rest */
+
+#define DDB_LAT_BINS 8
+
+/* Histogram bin of a time, bin i counts times below 16us * 4^i */
+
+static inline u32 ddb_lat_bin(ktime_t t)
+{
+	s64 ns = ktime_to_ns(t) >> 14;
+	u32 bin = 0;
+
+	while (ns > 0 && bin < DDB_LAT_BINS - 1) {
+		ns >>= 2;
+		bin++;
+	}
+	return bin;
+}
+
+struct ddb_dma_stat {
+	u64                    bytes;
+	u32                    blocks;
+	u32                    overflows;
+	u32                    irqs;
+	u32                    irq_lat[DDB_LAT_BINS];   /* IRQ to work start */
+	u32                    work_lat[DDB_LAT_BINS];  /* work duration */
+};
+
 struct ddb_dma {
 	void                  *io;
 	u32                    nr;
@@ -174,9 +206,16 @@ struct ddb_dma {
 	u32                    size;
 	u32                    div;
 	u32                    bufreg;
+	u32                    dir;       /* 1 = output */
+	u32                    mode;      /* buffer type, see dma_mode */
+	struct mutex           buf_lock;  /* allocation of vbuf/pbuf, users */
+	struct delayed_work    idle_work; /* frees unused buffers, see dma_idle */
+	int                    users;     /* ddb_dma_get() without put */
 
 #ifdef DDB_USE_WORK
 	struct work_struct     work;
+	cpumask_t              cpus;      /* CPUs for the work, empty = any */
+	int                    cpu;       /* CPU the work is queued on or -1 */
 #else
 	struct tasklet_struct  tasklet;
 #endif
@@ -187,6 +226,14 @@ struct ddb_dma {
 	u32                    ctrl;
 	u32                    cbuf;
 	u32                    coff;
+	u32                    wm;        /* bytes for wake up of reader/writer */
+
+	struct dvb_ci_dma_ctrl *map;
+
+	struct ddb_dma_stat __percpu *pstat;
+	u32                    sidx;      /* block index at last accounting */
+	u32                    sseq;      /* blocks stamped since start */
+	ktime_t                irq_time;
 };
 
 struct ddb_dvb {
@@ -202,6 +249,7 @@ struct ddb_dvb {
 	struct dmx_frontend    hw_frontend;
 	struct dmx_frontend    mem_frontend;
 	int                    users;
+	int                    dma_held;  /* first user did ddb_dma_get() */
 	int (*gate_ctrl)(struct dvb_frontend *, int);
 	int                    attached;
 };
@@ -213,17 +261,45 @@ struct ddb_ci {
 	struct mutex           lock;
 };
 
+#define DDB_MAX_FAN 3  /* outputs reading the buffers of redo in addition */
+
+/* Outputs and inputs behind a redirected input in start order.
+   Never changed once published, replaced as a whole under RCU. */
+
+#define DDB_CHAIN_MAX 32
+
+struct ddb_io;
+
+struct ddb_chain {
+	struct rcu_head        rcu;
+	u32                    num;
+	struct ddb_io         *io[DDB_CHAIN_MAX];
+	u8                     out[DDB_CHAIN_MAX];
+};
+
 struct ddb_io {
 	struct ddb_port       *port;
 	u32                    nr;
 	struct ddb_dma        *dma;
 	struct ddb_io         *redo;
 	struct ddb_io         *redi;
+	struct ddb_io         *fan[DDB_MAX_FAN];
+	u32                    fan_num;
+	struct ddb_chain __rcu *chain;
 };
 
 #define ddb_output ddb_io
 #define ddb_input ddb_io
 
+struct ddb_i2c_stat {
+	u32                    tasks;
+	u64                    bytes;
+	u32                    timeouts;
+	u32                    naks;
+	u32                    lat[DDB_LAT_BINS];       /* task duration */
+	atomic_t               gate_lat[DDB_LAT_BINS];  /* i2c_gate_lock wait */
+};
+
 struct ddb_i2c {
 	struct ddb            *dev;
 	u32                    nr;
@@ -232,6 +308,8 @@ struct ddb_i2c {
 	u32                    rbuf;
 	u32                    wbuf;
 	struct completion      completion;
+	struct ddb_i2c_stat    stat;      /* gate_lat is atomic, the rest is
+					     updated under the adapter lock */
 };
 
 struct ddb_port {
@@ -273,6 +351,9 @@ struct ddb_port {
 	struct ddb_dvb         dvb[2];
 	u32                    gap;
 	u32                    obr;
+
+	struct work_struct     probe_work;
+	u32                    probe_ms;  /* duration of ddb_port_probe() */
 };
 
 
@@ -322,6 +403,27 @@ struct mod_state {
 
 #define TS_CAPTURE_LEN  (21*188)
 
+#define DDB_NSD_QUEUE 32  /* max. queued plus unread captures */
+
+struct ddb_nsd_req {
+	struct list_head       list;
+	struct dvb_nsd_ts      ts;
+	struct dvb_nsd_result  res;
+	unsigned long          end;       /* jiffies when we give up */
+	u8                     buf[TS_CAPTURE_LEN];
+};
+
+struct ddb_nsd {
+	struct mutex           lock;
+	struct list_head       queue;     /* waiting for the capture engine */
+	struct list_head       done;      /* finished, not read yet */
+	struct ddb_nsd_req    *cur;       /* running on the capture engine */
+	u32                    num;       /* requests in queue, cur and done */
+	u32                    id;
+	struct delayed_work    work;
+	wait_queue_head_t      wq;
+};
+
 /* net streaming hardware block */
 
 #define DDB_NS_MAX 15
@@ -337,6 +439,39 @@ struct ddb_ns {
 	u8                     p[512];
 };
 
+/* adaptive interrupt moderation of the input DMA channels */
+
+struct ddb_irq_mod {
+	spinlock_t             lock;
+	struct timer_list      timer;
+	u32                    high;      /* IRQs/s of a channel to start polling */
+	u32                    interval;  /* poll interval in ms */
+	u32                    idle;      /* idle polls before unmasking the IRQ */
+	u32                    budget;    /* channels served per poll pass */
+
+	u32                    enable;    /* shadow of all MSI<n>_ENABLE */
+	u32                    polling;   /* masked channels served by the timer */
+	u32                    next;
+	unsigned long          window;
+	u32                    count[32];
+	u32                    idle_cnt[32];
+	u32                    last_stat[32];
+	u32                    rate[32];  /* IRQs/s of each channel */
+	u32                    polls;
+};
+
+/* one MSI vector and the interrupt sources routed to it */
+
+#define DDB_MAX_MSI 8
+
+struct ddb_irq_vec {
+	struct ddb            *dev;
+	u32                    nr;
+	u32                    mask;      /* value for MSI<nr>_ENABLE */
+	int                    cpu;       /* affinity hint, -1 if none */
+	u32                    irqs;
+};
+
 struct ddb {
 	struct pci_dev        *pdev;
 	struct platform_device *pfdev;
@@ -344,6 +479,7 @@ struct ddb {
 	struct ddb_ids         ids;
 	struct ddb_info       *info;
 	int                    msi;
+	int                    node;      /* NUMA node of the card or -1 */
 	struct workqueue_struct *wq;
 	u32                    has_dma;
 	u32                    has_ns;
@@ -367,8 +503,11 @@ struct ddb {
 	u8                     iobuf[1028];
 
 	u8                     leds;
-	u32                    ts_irq;
-	u32                    i2c_irq;
+	atomic_t               ts_irq;    /* bumped from all MSI vectors */
+	atomic_t               i2c_irq;
+	struct ddb_irq_mod     irq_mod;
+	u32                    irq_vecs;
+	struct ddb_irq_vec     vec[DDB_MAX_MSI];
 
 	int                    ns_num;
 	struct ddb_ns          ns[DDB_NS_MAX];
@@ -376,6 +515,7 @@ struct ddb {
 
 	struct dvb_device     *nsd_dev;
 	u8                     tsbuf[TS_CAPTURE_LEN];
+	struct ddb_nsd         nsd;
 
 	struct mod_base        mod_base;
 	struct mod_state       mod[10];
@@ -82,6 +82,7 @@ static int __init octonet_probe(struct platform_device *pdev)
 		return -ENOMEM;
 	platform_set_drvdata(pdev, dev);
 	dev->dev = &pdev->dev;
+	dev->node = -1;
 	dev->pfdev = pdev;
 	dev->info = &ddb_octonet;
 
@@ -112,12 +113,13 @@ static int __init octonet_probe(struct platform_device *pdev)
 	pr_info("MAC %08x DEVID  %08x\n", dev->ids.mac, dev->ids.devid);
 
 	ddbwritel(dev, 0x00000000, INTERRUPT_ENABLE);
+	ddb_irq_mod_init(dev);
 
 	if (request_irq(platform_get_irq(dev->pfdev, 0), irq_handler,
 			IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
 			"octonet-dvb", (void *) dev) < 0)
 		goto fail;
-	ddbwritel(dev, 0x0fffff0f, INTERRUPT_ENABLE);
+	ddb_irq_write_enable(dev);
 	ddbwritel(dev, 0x1, ETHER_CONTROL);
 	ddbwritel(dev, 14 + (vlan ? 4 : 0), ETHER_LENGTH);
 
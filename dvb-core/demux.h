@@ -82,6 +82,8 @@ enum dmx_success {
 #define TS_DECODER      4   /* send stream to built-in decoder (if present) */
 #define TS_DEMUX        8   /* in case TS_PACKET is set, send the TS to
 			       the demux device, not to the dvr device */
+#define TS_COALESCE    16   /* in case TS_PACKET is set, the callback takes
+			       runs of packets in buffer1 and buffer2 */
 
 struct dmx_ts_feed {
 	int is_filtering; /* Set to non-zero when filtering in progress */
@@ -105,6 +107,9 @@ struct dmx_section_filter {
 	u8 filter_value [DMX_MAX_FILTER_SIZE];
 	u8 filter_mask [DMX_MAX_FILTER_SIZE];
 	u8 filter_mode [DMX_MAX_FILTER_SIZE];
+	int changes_only; /* only deliver sections with a new CRC_32 for
+			     their table_id/extension/section_number,
+			     set before start_filtering() */
 	struct dmx_section_feed* parent; /* Back-pointer */
 	void* priv; /* Pointer to private data of the API client */
 };
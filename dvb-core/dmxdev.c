@@ -584,6 +584,8 @@ static int dvb_dmxdev_start_feed(struct dmxdev *dmxdev,
 		ts_type |= TS_PACKET | TS_DEMUX;
 	else if (otype == DMX_OUT_TAP)
 		ts_type |= TS_PACKET | TS_DEMUX | TS_PAYLOAD_ONLY;
+	if ((ts_type & (TS_PACKET | TS_PAYLOAD_ONLY)) == TS_PACKET)
+		ts_type |= TS_COALESCE;
 
 	ret = dmxdev->demux->allocate_ts_feed(dmxdev->demux, &feed->ts,
 					      dvb_dmxdev_ts_callback);
@@ -698,6 +700,8 @@ static int dvb_dmxdev_filter_start(struct dmxdev_filter *filter)
 		(*secfilter)->filter_mode[0] = para->filter.mode[0];
 		(*secfilter)->filter_mask[1] = 0;
 		(*secfilter)->filter_mask[2] = 0;
+		(*secfilter)->changes_only =
+			(para->flags & DMX_CHANGES_ONLY) ? 1 : 0;
 
 		filter->todo = 0;
 
@@ -0,0 +1,184 @@
+/*
+ * dvb_crc32.c: CRC_32 of MPEG-2 sections and ULE SNDUs
+ *
+ * Slice-by-8: eight table lookups per eight bytes instead of one per
+ * byte. The tables are computed on load, and the fast path is only
+ * used after it matched crc32_be().
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 only, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/crc32.h>
+#include <linux/random.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <asm/unaligned.h>
+#include <asm/div64.h>
+
+#include "dvb_crc32.h"
+
+#define DVB_CRC32_POLY 0x04c11db7
+
+static int dvb_crc32_generic;
+module_param(dvb_crc32_generic, int, 0444);
+MODULE_PARM_DESC(dvb_crc32_generic,
+		 "use crc32_be() for section and ULE CRCs instead of slice-by-8");
+
+static bool dvb_crc32_fast;
+static u32 dvb_crc32_tab[8][256] __read_mostly;
+
+static u32 dvb_crc32_be8(u32 crc, const u8 *buf, size_t len)
+{
+	const u32 (*t)[256] = dvb_crc32_tab;
+	u32 a, b;
+
+	for (; len && ((unsigned long) buf & 3); len--)
+		crc = (crc << 8) ^ t[0][(crc >> 24) ^ *buf++];
+
+	for (; len >= 8; len -= 8, buf += 8) {
+		a = crc ^ get_unaligned_be32(buf);
+		b = get_unaligned_be32(buf + 4);
+		crc = t[7][a >> 24] ^ t[6][(a >> 16) & 0xff] ^
+			t[5][(a >> 8) & 0xff] ^ t[4][a & 0xff] ^
+			t[3][b >> 24] ^ t[2][(b >> 16) & 0xff] ^
+			t[1][(b >> 8) & 0xff] ^ t[0][b & 0xff];
+	}
+
+	while (len--)
+		crc = (crc << 8) ^ t[0][(crc >> 24) ^ *buf++];
+	return crc;
+}
+
+u32 dvb_crc32_be(u32 crc, const u8 *buf, size_t len)
+{
+	if (dvb_crc32_fast)
+		return dvb_crc32_be8(crc, buf, len);
+	return crc32_be(crc, buf, len);
+}
+EXPORT_SYMBOL(dvb_crc32_be);
+
+/* check value of CRC-32/MPEG-2 and random data at all alignments */
+static int dvb_crc32_selftest(void)
+{
+	u8 *buf;
+	u32 crc;
+	int i, ret = 0;
+
+	if (dvb_crc32_be8(~0, (const u8 *) "123456789", 9) != 0x0376e6e7)
+		return -EINVAL;
+
+	buf = vmalloc(1024);
+	if (!buf)
+		return -ENOMEM;
+	get_random_bytes(buf, 1024);
+	for (i = 0; i < 256 && !ret; i++) {
+		crc = ~0 ^ i;
+		if (dvb_crc32_be8(crc, buf + (i & 3), 4 * i) !=
+		    crc32_be(crc, buf + (i & 3), 4 * i) ||
+		    dvb_crc32_be8(crc, buf + i, 1021 - i) !=
+		    crc32_be(crc, buf + i, 1021 - i))
+			ret = -EINVAL;
+	}
+	vfree(buf);
+	return ret;
+}
+
+void dvb_crc32_init(void)
+{
+	u32 crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i << 24;
+		for (j = 0; j < 8; j++)
+			crc = (crc << 1) ^
+				((crc & 0x80000000) ? DVB_CRC32_POLY : 0);
+		dvb_crc32_tab[0][i] = crc;
+	}
+	for (j = 1; j < 8; j++)
+		for (i = 0; i < 256; i++) {
+			crc = dvb_crc32_tab[j - 1][i];
+			dvb_crc32_tab[j][i] = (crc << 8) ^
+				dvb_crc32_tab[0][crc >> 24];
+		}
+
+	if (dvb_crc32_selftest()) {
+		printk(KERN_ERR "dvb-core: CRC32 self test failed, "
+		       "using crc32_be()\n");
+		return;
+	}
+	dvb_crc32_fast = !dvb_crc32_generic;
+}
+
+#ifdef CONFIG_DVB_CORE_BENCH
+
+/*
+ * Throughput benchmark (only built with CONFIG_DVB_CORE_BENCH):
+ * echo <n> > /sys/module/dvb_core/parameters/dvb_crc32_bench
+ * logs MB/s of crc32_be() and slice-by-8 over n byte buffers.
+ */
+
+#define DVB_CRC32_BENCH_BYTES (16 << 20)
+
+static int dvb_crc32_bench_run(int len)
+{
+	u32 (*fn[2])(u32, const u8 *, size_t) = { crc32_be, dvb_crc32_be8 };
+	u64 ns, mbs[2];
+	ktime_t start;
+	u32 crc[2];
+	u8 *buf;
+	int i, n, rounds = DVB_CRC32_BENCH_BYTES / len;
+
+	buf = vmalloc(len);
+	if (!buf)
+		return -ENOMEM;
+	get_random_bytes(buf, len);
+	for (i = 0; i < 2; i++) {
+		crc[i] = ~0;
+		start = ktime_get();
+		for (n = 0; n < rounds; n++)
+			crc[i] = fn[i](crc[i], buf, len);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start)) ? : 1;
+		mbs[i] = div64_u64((u64) rounds * len * 1000, ns);
+	}
+	vfree(buf);
+	printk(KERN_INFO "dvb-core: CRC32 %d bytes: crc32_be %llu MB/s, "
+	       "slice-by-8 %llu MB/s%s\n", len, mbs[0], mbs[1],
+	       crc[0] == crc[1] ? "" : " MISMATCH");
+	return crc[0] == crc[1] ? 0 : -EINVAL;
+}
+
+static int dvb_crc32_bench;
+
+static int dvb_crc32_bench_set(const char *val, const struct kernel_param *kp)
+{
+	int ret = param_set_int(val, kp);
+
+	if (ret < 0)
+		return ret;
+	if (dvb_crc32_bench < 1 || dvb_crc32_bench > (1 << 20))
+		return -EINVAL;
+	return dvb_crc32_bench_run(dvb_crc32_bench);
+}
+
+static struct kernel_param_ops dvb_crc32_bench_ops = {
+	.set = dvb_crc32_bench_set,
+	.get = param_get_int,
+};
+
+module_param_cb(dvb_crc32_bench, &dvb_crc32_bench_ops, &dvb_crc32_bench,
+		0644);
+MODULE_PARM_DESC(dvb_crc32_bench,
+		 "write n to log CRC32 MB/s over n byte buffers");
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * dvb_crc32.h: CRC_32 of MPEG-2 sections and ULE SNDUs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 only, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __DVB_CRC32_H
+#define __DVB_CRC32_H
+
+#include <linux/types.h>
+
+/**
+ * continues the MPEG-2 CRC_32 (polynomial 0x04c11db7, msb first,
+ * no final inversion) like crc32_be()
+ *
+ * start with crc = ~0, over a section including its CRC_32 the
+ * result is 0
+ *
+ * @param crc The CRC of the preceding data
+ * @param buf The data
+ * @param len The number of bytes
+ * @return CRC of the preceding data and buf
+ */
+extern u32 dvb_crc32_be(u32 crc, const u8 *buf, size_t len);
+
+/* builds the tables and selects slice-by-8 if it passes the self test */
+extern void dvb_crc32_init(void);
+
+#endif
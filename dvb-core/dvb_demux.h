@@ -23,6 +23,7 @@
 #ifndef _DVB_DEMUX_H_
 #define _DVB_DEMUX_H_
 
+#include <linux/types.h>
 #include <linux/time.h>
 #include <linux/timer.h>
 #include <linux/spinlock.h>
@@ -46,11 +47,23 @@
 
 #define SPEED_PKTS_INTERVAL 50000
 
+/* Last delivered CRC_32 of the sections of a changes_only filter,
+   hashed by table_id/extension/section_number. A hash collision only
+   causes a section to be delivered again. */
+#define DVB_DEMUX_SEEN_BITS 8
+
+struct dvb_demux_secseen {
+	DECLARE_BITMAP(used, 1 << DVB_DEMUX_SEEN_BITS);
+	u32 key[1 << DVB_DEMUX_SEEN_BITS];
+	u32 crc[1 << DVB_DEMUX_SEEN_BITS];
+};
+
 struct dvb_demux_filter {
 	struct dmx_section_filter filter;
 	u8 maskandmode[DMX_MAX_FILTER_SIZE];
 	u8 maskandnotmode[DMX_MAX_FILTER_SIZE];
 	int doneq;
+	struct dvb_demux_secseen *seen;
 
 	struct dvb_demux_filter *next;
 	struct dvb_demux_feed *feed;
@@ -62,6 +75,23 @@ struct dvb_demux_filter {
 	struct timer_list timer;
 };
 
+/* Section filters of a feed compiled by prepare_secfilters(): the
+   DVB_DEMUX_MASK_MAX filter bytes as 64 bit words, sorted by table_id */
+struct dvb_demux_secmatch {
+	u64 value[3];
+	u64 maskandmode[3];
+	u64 maskandnotmode[3];
+	int doneq;
+	struct dvb_demux_filter *filter;
+};
+
+struct dvb_demux_secbank {
+	/* m[first[t]] .. m[first[t + 1] - 1] match table_id t only,
+	   m[first[256]] .. m[first[257] - 1] any table_id */
+	u16 first[258];
+	struct dvb_demux_secmatch m[0];
+};
+
 #define DMX_FEED_ENTRY(pos) list_entry(pos, struct dvb_demux_feed, list_head)
 
 struct dvb_demux_feed {
@@ -85,6 +115,7 @@ struct dvb_demux_feed {
 
 	struct timespec timeout;
 	struct dvb_demux_filter *filter;
+	struct dvb_demux_secbank *secbank;	/* NULL: walk filter list */
 
 	int ts_type;
 	enum dmx_ts_pes pes_type;
@@ -95,6 +126,7 @@ struct dvb_demux_feed {
 	u16 peslen;
 
 	struct list_head list_head;
+	struct dvb_demux_feed *pid_next;	/* next feed in pid_feed[pid] */
 	unsigned int index;	/* a unique index for each feed (can be used as hardware pid filter index) */
 };
 
@@ -126,8 +158,18 @@ struct dvb_demux {
 
 #define DMX_MAX_PID 0x2000
 	struct list_head feed_list;
+	/* feeds of feed_list by PID, [DMX_MAX_PID] has the full TS feeds */
+	struct dvb_demux_feed **pid_feed;
 	u8 tsbuf[204];
 	int tsbufp;
+	u32 resync_cnt; /* sync losses in dvb_dmx_swfilter(_204) */
+
+	/* run of consecutive packets of one TS_COALESCE feed, delivered
+	   with one callback when another feed gets a packet or on unlock */
+	int coalesce;
+	struct dvb_demux_feed *run_feed;
+	const u8 *run[2];
+	size_t run_len[2];
 
 	struct mutex mutex;
 	spinlock_t lock;
@@ -142,6 +184,8 @@ int dvb_dmx_init(struct dvb_demux *dvbdemux);
 void dvb_dmx_release(struct dvb_demux *dvbdemux);
 void dvb_dmx_swfilter_packets(struct dvb_demux *dvbdmx, const u8 *buf,
 			      size_t count);
+void dvb_dmx_swfilter_blocks(struct dvb_demux *demux, const u8 * const *bufs,
+			     int num, size_t count);
 void dvb_dmx_swfilter(struct dvb_demux *demux, const u8 *buf, size_t count);
 void dvb_dmx_swfilter_204(struct dvb_demux *demux, const u8 *buf,
 			  size_t count);
@@ -61,12 +61,12 @@
 #include <linux/dvb/net.h>
 #include <linux/uio.h>
 #include <asm/uaccess.h>
-#include <linux/crc32.h>
 #include <linux/mutex.h>
 #include <linux/sched.h>
 
 #include "dvb_demux.h"
 #include "dvb_net.h"
+#include "dvb_crc32.h"
 
 #ifndef ETH_P_802_3_MIN
 #define ETH_P_802_3_MIN 1536
@@ -83,7 +83,7 @@ static inline __u32 iov_crc32( __u32 c, struct kvec *iov, unsigned int cnt )
 {
 	unsigned int j;
 	for (j = 0; j < cnt; j++)
-		c = crc32_be( c, iov[j].iov_base, iov[j].iov_len );
+		c = dvb_crc32_be( c, iov[j].iov_base, iov[j].iov_len );
 	return c;
 }
 
@@ -34,6 +34,7 @@
 #include <linux/mutex.h>
 #include <linux/version.h>
 #include "dvbdev.h"
+#include "dvb_crc32.h"
 
 static DEFINE_MUTEX(dvbdev_mutex);
 static int dvbdev_debug;
@@ -489,6 +490,7 @@ static int __init init_dvbdev(void)
 	}
 	dvb_class->dev_uevent = dvb_uevent;
 	dvb_class->devnode = dvb_devnode;
+	dvb_crc32_init();
 	return 0;
 
 error:
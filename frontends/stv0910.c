@@ -157,6 +157,51 @@ static int write_reg(struct stv *state, u16 reg, u8 val)
 	return i2c_write_reg16(state->base->i2c, state->base->adr, reg, val);
 }
 
+/* Write a table of registers with as few i2c_transfer() calls as possible.
+   After a partial failure only the failing register is retried on its
+   own, the rest of the table is batched again. Adapters which reject a
+   queue get one register at a time. */
+
+#define STV_TABLE_BATCH 16
+
+static int write_table(struct stv *state, const struct SInitTable *tab,
+		       int num)
+{
+	struct i2c_msg msgs[STV_TABLE_BATCH];
+	u8 buf[STV_TABLE_BATCH][3];
+	int i, n, ret, batch = STV_TABLE_BATCH;
+
+	while (num) {
+		n = min(num, batch);
+		for (i = 0; i < n; i++) {
+			buf[i][0] = tab[i].Address >> 8;
+			buf[i][1] = tab[i].Address & 0xff;
+			buf[i][2] = tab[i].Data;
+			msgs[i].addr = state->base->adr;
+			msgs[i].flags = 0;
+			msgs[i].buf = buf[i];
+			msgs[i].len = 3;
+		}
+		ret = i2c_transfer(state->base->i2c, msgs, n);
+		if (ret == n) {
+			tab += n;
+			num -= n;
+			continue;
+		}
+		if (ret < 0) {
+			ret = 0;
+			batch = 1;
+		}
+		tab += ret;
+		num -= ret;
+		if (write_reg(state, tab->Address, tab->Data) < 0)
+			return -1;
+		tab++;
+		num--;
+	}
+	return 0;
+}
+
 static inline int i2c_read_reg16(struct i2c_adapter *adapter, u8 adr,
 				 u16 reg, u8 *val)
 {
@@ -921,6 +966,41 @@ static int init_diseqc(struct stv *state)
 static int probe(struct stv *state)
 {
 	u8 id;
+	const struct SInitTable gen_tab[] = {
+		{RSTV0910_OUTCFG,    0x00},  /* OUTCFG */
+		{RSTV0910_PADCFG,    0x05},  /* RF AGC Pads Dev = 05 */
+		{RSTV0910_SYNTCTRL,  0x02},  /* SYNTCTRL */
+		{RSTV0910_TSGENERAL, 0x00},  /* TSGENERAL */
+		{RSTV0910_CFGEXT,    0x02},  /* CFGEXT */
+		{RSTV0910_GENCFG,    0x15},  /* GENCFG */
+
+		{RSTV0910_TSTRES0,   0x80},  /* LDPC Reset */
+		{RSTV0910_TSTRES0,   0x00},
+	};
+	const struct SInitTable ts_tab[] = {
+		/* TS output */
+		{RSTV0910_P1_TSCFGH, state->tscfgh | 0x01},
+		{RSTV0910_P1_TSCFGH, state->tscfgh},
+		{RSTV0910_P1_TSCFGM, 0xC0},  /* Manual speed */
+		{RSTV0910_P1_TSCFGL, 0x20},
+
+		/* Speed = 67.5 MHz */
+		{RSTV0910_P1_TSSPEED, state->tsspeed},
+
+		{RSTV0910_P2_TSCFGH, state->tscfgh | 0x01},
+		{RSTV0910_P2_TSCFGH, state->tscfgh},
+		{RSTV0910_P2_TSCFGM, 0xC0},  /* Manual speed */
+		{RSTV0910_P2_TSCFGL, 0x20},
+
+		/* Speed = 67.5 MHz */
+		{RSTV0910_P2_TSSPEED, state->tsspeed},
+
+		/* Reset stream merger */
+		{RSTV0910_P1_TSCFGH, state->tscfgh | 0x01},
+		{RSTV0910_P2_TSCFGH, state->tscfgh | 0x01},
+		{RSTV0910_P1_TSCFGH, state->tscfgh},
+		{RSTV0910_P2_TSCFGH, state->tscfgh},
+	};
 
 	state->ReceiveMode = Mode_None;
 	state->Started = 0;
@@ -939,41 +1019,11 @@ static int probe(struct stv *state)
 	/* Set the I2C to oversampling ratio */
 	write_reg(state, RSTV0910_I2CCFG, 0x88);
 
-	write_reg(state, RSTV0910_OUTCFG,    0x00);  /* OUTCFG */
-	write_reg(state, RSTV0910_PADCFG,    0x05);  /* RF AGC Pads Dev = 05 */
-	write_reg(state, RSTV0910_SYNTCTRL,  0x02);  /* SYNTCTRL */
-	write_reg(state, RSTV0910_TSGENERAL, 0x00);  /* TSGENERAL */
-	write_reg(state, RSTV0910_CFGEXT,    0x02);  /* CFGEXT */
-	write_reg(state, RSTV0910_GENCFG,    0x15);  /* GENCFG */
-
-
-	write_reg(state, RSTV0910_TSTRES0, 0x80); /* LDPC Reset */
-	write_reg(state, RSTV0910_TSTRES0, 0x00);
+	write_table(state, gen_tab, ARRAY_SIZE(gen_tab));
 
 	set_mclock(state, 135000000);
 
-	/* TS output */
-	write_reg(state, RSTV0910_P1_TSCFGH , state->tscfgh | 0x01);
-	write_reg(state, RSTV0910_P1_TSCFGH , state->tscfgh);
-	write_reg(state, RSTV0910_P1_TSCFGM , 0xC0);  /* Manual speed */
-	write_reg(state, RSTV0910_P1_TSCFGL , 0x20);
-
-	/* Speed = 67.5 MHz */
-	write_reg(state, RSTV0910_P1_TSSPEED , state->tsspeed);
-
-	write_reg(state, RSTV0910_P2_TSCFGH , state->tscfgh | 0x01);
-	write_reg(state, RSTV0910_P2_TSCFGH , state->tscfgh);
-	write_reg(state, RSTV0910_P2_TSCFGM , 0xC0);  /* Manual speed */
-	write_reg(state, RSTV0910_P2_TSCFGL , 0x20);
-
-	/* Speed = 67.5 MHz */
-	write_reg(state, RSTV0910_P2_TSSPEED , state->tsspeed);
-
-	/* Reset stream merger */
-	write_reg(state, RSTV0910_P1_TSCFGH , state->tscfgh | 0x01);
-	write_reg(state, RSTV0910_P2_TSCFGH , state->tscfgh | 0x01);
-	write_reg(state, RSTV0910_P1_TSCFGH , state->tscfgh);
-	write_reg(state, RSTV0910_P2_TSCFGH , state->tscfgh);
+	write_table(state, ts_tab, ARRAY_SIZE(ts_tab));
 
 	write_reg(state, RSTV0910_P1_I2CRPT, state->i2crpt);
 	write_reg(state, RSTV0910_P2_I2CRPT, state->i2crpt);
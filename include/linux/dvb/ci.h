@@ -0,0 +1,55 @@
+#ifndef _UAPI_DVBCI_H_
+#define _UAPI_DVBCI_H_
+
+#include <linux/types.h>
+
+/* Control page for mmap readers of the ci device.
+   It is mapped read-only at offset 0 (one page), the input DMA blocks
+   are mapped read-only at offset getpagesize(), each block starting at
+   a multiple of stride bytes. Blocks are given back with CI_DMA_ACK. */
+
+#define DVB_CI_DMA_MAX 32   /* max. number of DMA blocks */
+
+/* Completion time of a DMA block */
+
+struct dvb_ci_dma_stamp {
+	__u64    ns;        /* CLOCK_MONOTONIC in ns */
+	__u32    seq;       /* number of the block since the input started */
+	__u32    res;
+};
+
+struct dvb_ci_dma_ctrl {
+	__u32    num;       /* number of DMA blocks */
+	__u32    size;      /* bytes per block */
+	__u32    stride;    /* distance of blocks in the mapping */
+	__u32    cur;       /* hardware position: block << 11 | off >> 7 */
+	__u32    ctrl;      /* DMA control, bit 2 = overflow */
+	__u32    ack;       /* next block to be read, set by CI_DMA_ACK */
+
+	/* indexed by block, valid for the blocks up to cur */
+	struct dvb_ci_dma_stamp stamp[DVB_CI_DMA_MAX];
+};
+
+struct dvb_ci_dma_stamps {
+	__u32    num;       /* number of DMA blocks */
+	__u32    res;
+	struct dvb_ci_dma_stamp stamp[DVB_CI_DMA_MAX];
+};
+
+/* Wake up thresholds in bytes: read and poll wait for rx bytes,
+   write and poll for tx free bytes. 0 selects the default (one packet).
+   CI_SET_WATERMARK on a reader only sets rx, tx must be 0, on a writer
+   only tx, rx must be 0.
+   They are reset when the device is opened for reading or writing. */
+
+struct dvb_ci_watermark {
+	__u32    rx;
+	__u32    tx;
+};
+
+#define CI_DMA_ACK               _IOW('o', 224, __u32)
+#define CI_SET_WATERMARK         _IOW('o', 225, struct dvb_ci_watermark)
+#define CI_GET_WATERMARK         _IOR('o', 226, struct dvb_ci_watermark)
+#define CI_GET_STAMPS            _IOR('o', 227, struct dvb_ci_dma_stamps)
+
+#endif /*_UAPI_DVBCI_H_*/
@@ -104,6 +104,7 @@ struct dmx_sct_filter_params
 #define DMX_CHECK_CRC       1
 #define DMX_ONESHOT         2
 #define DMX_IMMEDIATE_START 4
+#define DMX_CHANGES_ONLY    8   /* drop repeats of unchanged sections */
 #define DMX_KERNEL_CLIENT   0x8000
 };
 
@@ -65,4 +65,22 @@ struct dvb_nsd_ts {
 #define NS_INSERT_PACKETS	 _IOW('o', 203, __u8)
 #define NS_SET_CI	         _IOW('o', 204, __u8)
 
+/* Queued captures: NSD_QUEUE_GET_TS takes the same parameters as
+   NSD_START_GET_TS (ts, len are not used), queues the capture and
+   returns its id (> 0). The driver runs the queued captures one after
+   the other. Each finished capture can be read() from the nsd device
+   as struct dvb_nsd_result followed by len bytes of TS packets,
+   poll() signals POLLIN while results are available. */
+
+struct dvb_nsd_result {
+	__u32    id;
+	__s32    status;    /* 0, -ETIMEDOUT or -ECANCELED */
+	__u16    input;
+	__u16    pid;
+	__u16    len;
+	__u16    res;
+};
+
+#define NSD_QUEUE_GET_TS         _IOW('o', 205, struct dvb_nsd_ts)
+
 #endif /*_UAPI_DVBNS_H_*/